@@ -9,6 +9,10 @@
 		'cflags': [
 			'--std=c++11',
 			'-g',
+			'-pthread',
+		],
+		'ldflags': [
+			'-pthread',
 		],
 	},
 	'targets': [
@@ -19,10 +23,34 @@
 			'sources': [
 				'lexer.cc',
 				'scanner.cc',
+				'utf8.cc',
 				'token.cc',
 				'tree.cc',
 				'parser.cc',
 				'functions.cc',
+				'intern.cc',
+				'optimize.cc',
+				'expand.cc',
+				'module.cc',
+				'session.cc',
+				'pool.cc',
+				'fiber.cc',
+				'codec.cc',
+				'image.cc',
+				'astcache.cc',
+				'server.cc',
+				'printer.cc',
+				'profile.cc',
+				'metrics.cc',
+				'mapped.cc',
+				'reader.cc',
+				'hamt.cc',
+				'vlist.cc',
+				'shared_string.cc',
+				'fuel.cc',
+				'heap.cc',
+				'isolate.cc',
+				'io.cc',
 			],
 			'include_dirs': [],
 		},
@@ -38,5 +66,40 @@
 				'main.cc',
 			],
 		},
+		{
+			'target_name': 'bench',
+			'type': 'executable',
+			'dependencies': [
+				'libcrisp',
+			],
+			'defines': [],
+			'include_dirs': [],
+			'sources': [
+				'bench.cc',
+				'corpus.cc',
+			],
+		},
+		{
+			'target_name': 'fiber_test',
+			'type': 'executable',
+			'dependencies': [
+				'libcrisp',
+			],
+			'defines': [],
+			'include_dirs': [],
+			'sources': [
+				'fiber_test.cc',
+			],
+		},
+		{
+			'target_name': 'client',
+			'type': 'executable',
+			'dependencies': [],
+			'defines': [],
+			'include_dirs': [],
+			'sources': [
+				'client.cc',
+			],
+		},
 	],
 }
@@ -0,0 +1,64 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "astcache.h"
+#include "codec.h"
+#include "image.h"
+
+#include <cstdio>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crisp {
+
+namespace {
+
+std::string Hex(uint64_t v) {
+	std::stringstream s;
+	s << std::hex << v;
+	return s.str();
+}
+
+// names the root parsed from source. the length is kept alongside the
+// hash so that a colliding source must also be exactly as long.
+std::string Key(const std::string& source) {
+	return Hex(Fingerprint(source)) + "-" + Hex(source.size());
+}
+
+} // namespace
+
+std::string AstCache::File(const std::string& path) const {
+	return dir_ + "/" + Hex(Fingerprint(path)) + ".ast";
+}
+
+Node *AstCache::Get(const std::string& path, const std::string& source, Node::State *state) const {
+	Image *image = Image::Open(File(path));
+	if (image == nullptr) {
+		return nullptr;
+	}
+	// decoded nodes do not refer to the mapping.
+	Node *tree = image->Root(Key(source), state);
+	delete image;
+	return tree;
+}
+
+bool AstCache::Put(const std::string& path, const std::string& source, Node *tree) const {
+	mkdir(dir_.c_str(), 0755);
+
+	ImageWriter w(nullptr);
+	w.AddRoot(Key(source), tree);
+
+	// written aside and renamed, so readers never see a partial entry.
+	std::string file = File(path);
+	std::string tmp = file + "." + std::to_string(getpid());
+	if (!w.Write(tmp)) {
+		unlink(tmp.c_str());
+		return false;
+	}
+	return rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+} // namespace crisp
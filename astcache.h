@@ -0,0 +1,37 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_ASTCACHE_H_
+#define CRISP_ASTCACHE_H_
+
+#include "tree.h"
+
+#include <string>
+
+namespace crisp {
+
+// AstCache keeps parsed trees of source files in a directory, as
+// single root images. Each source path has one entry, whose root is
+// named by the hash and length of the contents it was parsed from, so
+// an unchanged file is loaded without lexing or parsing it.
+class AstCache {
+public:
+	AstCache(const std::string& dir) : dir_(dir) {}
+
+	// returns the cached tree for source read from path, or nullptr.
+	Node *Get(const std::string& path, const std::string& source, Node::State *state) const;
+
+	// stores the tree parsed from source, replacing the path's entry.
+	// returns false if it could not be written.
+	bool Put(const std::string& path, const std::string& source, Node *tree) const;
+private:
+	// returns the cache file for a source path.
+	std::string File(const std::string& path) const;
+
+	std::string dir_;
+};
+
+} // namespace crisp
+
+#endif // CRISP_ASTCACHE_H_
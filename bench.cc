@@ -0,0 +1,250 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// bench runs the interpreter's microbenchmarks and prints one json
+// object per benchmark, for comparing results across commits.
+//
+//   bench [--filter substring] [--min-time milliseconds]
+
+#include "corpus.h"
+#include "lexer.h"
+#include "parser.h"
+#include "channel.h"
+#include "functions.h"
+#include "isolate.h"
+#include "reader.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace crisp;
+
+namespace {
+
+struct Benchmark {
+	std::string name;
+	// runs one iteration and returns the number of items it processed.
+	std::function<long()> run;
+};
+
+// runs b until min_time has passed and prints its result.
+void Run(const Benchmark& b, std::chrono::milliseconds min_time) {
+	typedef std::chrono::steady_clock Clock;
+	b.run(); // warm up
+
+	long iterations = 0, items = 0;
+	auto start = Clock::now();
+	auto elapsed = Clock::duration::zero();
+	while (elapsed < min_time) {
+		items += b.run();
+		iterations++;
+		elapsed = Clock::now() - start;
+	}
+	double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	std::cout << "{\"name\": \"" << b.name << "\""
+		<< ", \"iterations\": " << iterations
+		<< ", \"ns_per_iteration\": " << static_cast<long>(ns / iterations)
+		<< ", \"items_per_second\": " << static_cast<long>(items / (ns / 1e9))
+		<< "}" << std::endl;
+}
+
+// returns every token of source.
+std::vector<Token *> Lex(const std::string& source) {
+	std::istringstream in(source);
+	InputScanner scanner(&in);
+	lexer::Lexer lex(&scanner);
+	std::vector<Token *> toks;
+	Token *tok;
+	while ((tok = lex.Get()) != nullptr) {
+		toks.push_back(tok);
+	}
+	return toks;
+}
+
+Benchmark Scan(const std::string& name, const std::string& source) {
+	return Benchmark{"scanner/" + name, [source]() {
+		std::istringstream in(source);
+		InputScanner scanner(&in);
+		long n = 0;
+		while (scanner.Next() != EOF) {
+			n++;
+		}
+		return n;
+	}};
+}
+
+Benchmark LexTokens(const std::string& name, const std::string& source) {
+	return Benchmark{"lexer/" + name, [source]() {
+		std::vector<Token *> toks = Lex(source);
+		for (auto i: toks) {
+			delete i;
+		}
+		return static_cast<long>(toks.size());
+	}};
+}
+
+Benchmark ParseTokens(const std::string& name, const std::string& source) {
+	auto toks = std::make_shared<std::vector<Token *>>(Lex(source));
+	return Benchmark{"parser/" + name, [toks]() {
+		parser::Parser p;
+		for (auto i: *toks) {
+			p.Put(i);
+		}
+		return static_cast<long>(toks->size());
+	}};
+}
+
+// counts the events of a reader.
+class CountingHandler : public reader::Handler {
+public:
+	virtual bool BeginList() { n++; return true; }
+	virtual bool EndList() { n++; return true; }
+	virtual bool Atom(StringPiece text) { n++; return true; }
+	virtual bool Number(long long value, StringPiece text) { n++; return true; }
+	virtual bool String(StringPiece text) { n++; return true; }
+	long n = 0;
+};
+
+Benchmark ReadEvents(const std::string& name, const std::string& source) {
+	return Benchmark{"reader/" + name, [source]() {
+		reader::Cursor cursor(source);
+		CountingHandler h;
+		reader::Read(&cursor, &h);
+		return static_cast<long>(source.size());
+	}};
+}
+
+Benchmark SkipForms(const std::string& name, const std::string& source) {
+	return Benchmark{"reader/skip-" + name, [source]() {
+		reader::Cursor cursor(source);
+		while (cursor.Next() == reader::Cursor::kBeginList) {
+			cursor.Skip();
+		}
+		return static_cast<long>(source.size());
+	}};
+}
+
+Benchmark Eval(const std::string& name, const std::string& source) {
+	std::istringstream in(source);
+	Node *tree = parser::Parse(&in, false);
+	auto forms = dynamic_cast<ParentNode *>(tree)->children().size();
+	return Benchmark{"eval/" + name, [tree, forms]() {
+		Node::State state;
+		tree->Eval(&state);
+		return static_cast<long>(forms);
+	}};
+}
+
+Benchmark ChannelHandoff(int capacity) {
+	return Benchmark{"channel/handoff-" + std::to_string(capacity), [capacity]() {
+		const long n = 100000;
+		Channel<long> chan(capacity);
+		std::thread producer([&chan]() {
+			for (long i = 0; i < n; i++) {
+				chan.Put(i);
+			}
+			chan.Kill();
+		});
+		long item;
+		while (chan.Get(&item)) {}
+		producer.join();
+		return n;
+	}};
+}
+
+Benchmark ScopeDepth(int depth) {
+	return Benchmark{"scope/get-depth-" + std::to_string(depth), [depth]() {
+		static Node::State state;
+		Node::State::SymbolTableInterface *s = state.symbol_table();
+		for (int i = 0; i < depth; i++) {
+			s = new Scope(s);
+			s->Put("local", nullptr);
+		}
+		const long n = 1000;
+		for (long i = 0; i < n; i++) {
+			s->Get("lambda");
+		}
+		return n;
+	}};
+}
+
+Benchmark Isolates(const std::string& name, const std::string& source, int isolates) {
+	return Benchmark{"isolate/" + name + "-" + std::to_string(isolates), [source, isolates]() {
+		std::vector<Isolate *> all;
+		std::vector<std::shared_ptr<Isolate::Result>> results;
+		for (int i = 0; i < isolates; i++) {
+			all.push_back(new Isolate(WorkerPool::Default()));
+			results.push_back(all.back()->Submit(source));
+		}
+		for (auto& i: results) {
+			i->Await();
+		}
+		for (auto i: all) {
+			delete i;
+		}
+		return static_cast<long>(isolates);
+	}};
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	std::string filter;
+	std::chrono::milliseconds min_time(200);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+			filter = argv[++i];
+		} else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+			min_time = std::chrono::milliseconds(atoi(argv[++i]));
+		} else {
+			std::cerr << "usage: " << argv[0] << " [--filter substring] [--min-time milliseconds]" << std::endl;
+			return 2;
+		}
+	}
+
+	const std::string deep = corpus::DeepNesting(2000);
+	const std::string wide = corpus::WideList(20000, 1);
+	const std::string strings = corpus::LongStrings(100, 1000, 2);
+	const std::string unicode = corpus::UnicodeList(20000, 1);
+	const std::string lambdas = corpus::NestedLambdas(200, 20);
+	const std::string calls = corpus::Calls(5000, 3);
+
+	std::vector<Benchmark> benchmarks = {
+		Scan("wide", wide),
+		Scan("strings", strings),
+		Scan("unicode", unicode),
+		LexTokens("deep", deep),
+		LexTokens("wide", wide),
+		LexTokens("strings", strings),
+		LexTokens("unicode", unicode),
+		ParseTokens("deep", deep),
+		ParseTokens("wide", wide),
+		ParseTokens("lambdas", lambdas),
+		ReadEvents("deep", deep),
+		ReadEvents("wide", wide),
+		ReadEvents("strings", strings),
+		SkipForms("wide", wide),
+		ChannelHandoff(1),
+		ChannelHandoff(5),
+		ChannelHandoff(64),
+		ScopeDepth(1),
+		ScopeDepth(8),
+		ScopeDepth(64),
+		Eval("calls", calls),
+		Eval("lambdas", lambdas),
+		Isolates("calls", calls, 1),
+		Isolates("calls", calls, 8),
+	};
+	for (auto& b: benchmarks) {
+		if (b.name.find(filter) != std::string::npos) {
+			Run(b, min_time);
+		}
+	}
+}
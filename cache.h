@@ -0,0 +1,73 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_CACHE_H_
+#define CRISP_CACHE_H_
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace crisp {
+
+// fixed capacity map that evicts the least recently used entry.
+template <typename k, typename v, typename hash, typename equal>
+class LruCache {
+public:
+	LruCache(std::size_t capacity) : capacity_(capacity) {}
+
+	// returns true and stores the cached value in *value if key is present.
+	// a successful lookup marks the entry as most recently used.
+	bool Get(const k& key, v *value) {
+		auto i = index.find(key);
+		if (i == index.end()) {
+			misses_++;
+			return false;
+		}
+		entries.splice(entries.begin(), entries, i->second);
+		*value = i->second->second;
+		hits_++;
+		return true;
+	}
+
+	// inserts or replaces the value for key,
+	// evicting the least recently used entry when full.
+	void Put(const k& key, const v& value) {
+		auto i = index.find(key);
+		if (i != index.end()) {
+			i->second->second = value;
+			entries.splice(entries.begin(), entries, i->second);
+			return;
+		}
+		if (capacity_ == 0) {
+			return;
+		}
+		if (entries.size() == capacity_) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+		entries.emplace_front(key, value);
+		index[entries.front().first] = entries.begin();
+	}
+
+	std::size_t size() const { return entries.size(); }
+	std::size_t capacity() const { return capacity_; }
+	unsigned long hits() const { return hits_; }
+	unsigned long misses() const { return misses_; }
+private:
+	typedef std::list<std::pair<k, v>> List;
+
+	// most recently used first.
+	List entries;
+	std::unordered_map<k, typename List::iterator, hash, equal> index;
+	const std::size_t capacity_;
+
+	unsigned long hits_ = 0;
+	unsigned long misses_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_CACHE_H_
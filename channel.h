@@ -6,9 +6,14 @@
 #ifndef CRISP_CHANNEL_H_
 #define CRISP_CHANNEL_H_
 
+#include "fiber.h"
+
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
+#include <memory>
+#include <vector>
 #include <atomic>
 #include <iostream>
 
@@ -82,6 +87,111 @@ private:
 	std::condition_variable empty;
 };
 
+// FiberChannel is a channel whose blocked operations park the calling
+// fiber instead of its thread, so many fibers can share a few workers.
+// Called outside of a fiber, operations block the thread.
+// A capacity of zero makes every send wait for its receiver.
+template <typename t>
+class FiberChannel {
+public:
+	FiberChannel(std::size_t capacity) : capacity_(capacity) {}
+
+	void Put(const t& item) {
+		std::unique_lock<std::mutex> lock(mut);
+		// hand the item straight to a waiting receiver.
+		while (!recvq.empty()) {
+			Entry e = recvq.front();
+			recvq.pop_front();
+			if (e.waiter->Claim()) {
+				*static_cast<t *>(e.waiter->slot) = item;
+				e.waiter->index = e.index;
+				lock.unlock();
+				e.waiter->Wake();
+				return;
+			}
+			// the receiver was selecting and completed elsewhere.
+		}
+		if (buf.size() < capacity_) {
+			buf.push_back(item);
+			return;
+		}
+		auto w = std::make_shared<Waiter>();
+		t copy = item;
+		w->slot = &copy;
+		sendq.push_back(Entry{w, 0});
+		lock.unlock();
+		w->Wait();
+	}
+
+	t Get() {
+		t item;
+		std::vector<FiberChannel *> chans = {this};
+		Select(chans, &item);
+		return item;
+	}
+
+	// receives an item from the first of chans to have one,
+	// returning the index of that channel.
+	static int Select(const std::vector<FiberChannel *>& chans, t *item) {
+		auto w = std::make_shared<Waiter>();
+		w->slot = item;
+		for (std::size_t i = 0; i < chans.size(); i++) {
+			FiberChannel *c = chans[i];
+			std::unique_lock<std::mutex> lock(c->mut);
+			if (!c->buf.empty() || !c->sendq.empty()) {
+				if (!w->Claim()) {
+					// already received from an earlier channel.
+					break;
+				}
+				c->Take(item);
+				return i;
+			}
+			while (!c->recvq.empty() && c->recvq.front().waiter->claimed) {
+				c->recvq.pop_front(); // completed selects.
+			}
+			c->recvq.push_back(Entry{w, static_cast<int>(i)});
+		}
+		w->Wait();
+		return w->index;
+	}
+
+	std::size_t capacity() const { return capacity_; }
+private:
+	struct Entry {
+		std::shared_ptr<Waiter> waiter;
+		int index;
+	};
+
+	// takes the next item, which must exist, while holding mut.
+	// blocked senders never select, so they can always be claimed.
+	void Take(t *item) {
+		if (!buf.empty()) {
+			*item = buf.front();
+			buf.pop_front();
+			if (!sendq.empty()) {
+				// room for a blocked sender's item.
+				Entry e = sendq.front();
+				sendq.pop_front();
+				e.waiter->Claim();
+				buf.push_back(*static_cast<t *>(e.waiter->slot));
+				e.waiter->Wake();
+			}
+		} else {
+			Entry e = sendq.front();
+			sendq.pop_front();
+			e.waiter->Claim();
+			*item = *static_cast<t *>(e.waiter->slot);
+			e.waiter->Wake();
+		}
+	}
+
+	std::mutex mut;
+	std::deque<t> buf;
+	const std::size_t capacity_;
+	std::deque<Entry> recvq;
+	std::deque<Entry> sendq;
+};
+
 } // namespace crisp
 
 #endif // CRISP_CHANNEL_H_
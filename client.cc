@@ -0,0 +1,67 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// client sends the script on stdin to a crisp server
+// and prints its reply.
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+bool WriteAll(int fd, const char *data, std::size_t size) {
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		std::cerr << "usage: " << argv[0] << " socket < script" << std::endl;
+		return 2;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+		std::cerr << "cannot connect to '" << argv[1] << "': " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	char buf[4096];
+	ssize_t n;
+	while ((n = read(0, buf, sizeof(buf))) > 0) {
+		if (!WriteAll(fd, buf, n)) {
+			std::cerr << "write: " << strerror(errno) << std::endl;
+			return 1;
+		}
+	}
+	// the end of the script.
+	shutdown(fd, SHUT_WR);
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		WriteAll(1, buf, n);
+	}
+	close(fd);
+	return 0;
+}
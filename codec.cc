@@ -0,0 +1,98 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "codec.h"
+
+namespace crisp {
+
+void Encoder::PutVarint(uint64_t v) {
+	while (v >= 0x80) {
+		PutByte(static_cast<uint8_t>(v) | 0x80);
+		v >>= 7;
+	}
+	PutByte(static_cast<uint8_t>(v));
+}
+
+void Encoder::PutSigned(int64_t v) {
+	PutVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+}
+
+void Encoder::PutFixed64(uint64_t v) {
+	for (int i = 0; i < 8; i++) {
+		PutByte(static_cast<uint8_t>(v >> (8 * i)));
+	}
+}
+
+void Encoder::PatchFixed64(std::size_t at, uint64_t v) {
+	for (int i = 0; i < 8; i++) {
+		buf[at + i] = static_cast<char>(v >> (8 * i));
+	}
+}
+
+bool Decoder::GetByte(uint8_t *b) {
+	if (!ok_ || pos_ >= size_) {
+		ok_ = false;
+		return false;
+	}
+	*b = static_cast<uint8_t>(data_[pos_++]);
+	return true;
+}
+
+bool Decoder::GetVarint(uint64_t *v) {
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t b;
+		if (!GetByte(&b)) {
+			return false;
+		}
+		*v |= static_cast<uint64_t>(b & 0x7f) << shift;
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	ok_ = false;
+	return false;
+}
+
+bool Decoder::GetSigned(int64_t *v) {
+	uint64_t u;
+	if (!GetVarint(&u)) {
+		return false;
+	}
+	*v = static_cast<int64_t>(u >> 1) ^ -static_cast<int64_t>(u & 1);
+	return true;
+}
+
+bool Decoder::GetFixed64(uint64_t *v) {
+	*v = 0;
+	for (int i = 0; i < 8; i++) {
+		uint8_t b;
+		if (!GetByte(&b)) {
+			return false;
+		}
+		*v |= static_cast<uint64_t>(b) << (8 * i);
+	}
+	return true;
+}
+
+bool Decoder::GetBytes(std::size_t n, std::string *s) {
+	if (!ok_ || n > size_ - pos_) {
+		ok_ = false;
+		return false;
+	}
+	s->assign(data_ + pos_, n);
+	pos_ += n;
+	return true;
+}
+
+uint64_t Fingerprint(const std::string& data) {
+	uint64_t h = 0xcbf29ce484222325;
+	for (char c: data) {
+		h ^= static_cast<uint8_t>(c);
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+} // namespace crisp
@@ -0,0 +1,62 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_CODEC_H_
+#define CRISP_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace crisp {
+
+// Encoder appends binary values to a buffer.
+// varints are little endian base 128, signed values are zigzag encoded.
+class Encoder {
+public:
+	void PutByte(uint8_t b) { buf.push_back(static_cast<char>(b)); }
+	void PutVarint(uint64_t v);
+	void PutSigned(int64_t v);
+	void PutFixed64(uint64_t v);
+	void PutBytes(const std::string& s) { buf.append(s); }
+
+	// overwrites a fixed width value written at offset at.
+	void PatchFixed64(std::size_t at, uint64_t v);
+
+	const std::string& data() const { return buf; }
+	std::size_t size() const { return buf.size(); }
+private:
+	std::string buf;
+};
+
+// Decoder reads binary values written by an Encoder.
+// reads past the end fail and leave ok() false.
+class Decoder {
+public:
+	Decoder(const char *data, std::size_t size) : data_(data), size_(size) {}
+
+	bool GetByte(uint8_t *b);
+	bool GetVarint(uint64_t *v);
+	bool GetSigned(int64_t *v);
+	bool GetFixed64(uint64_t *v);
+	bool GetBytes(std::size_t n, std::string *s);
+
+	// moves to offset at.
+	void Seek(std::size_t at) { pos_ = at; }
+	std::size_t pos() const { return pos_; }
+	bool ok() const { return ok_; }
+private:
+	const char *data_;
+	std::size_t size_;
+	std::size_t pos_ = 0;
+	bool ok_ = true;
+};
+
+// returns the 64 bit FNV-1a hash of data,
+// which unlike std::hash is stable across builds.
+uint64_t Fingerprint(const std::string& data);
+
+} // namespace crisp
+
+#endif // CRISP_CODEC_H_
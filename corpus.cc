@@ -0,0 +1,142 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "corpus.h"
+
+namespace crisp {
+namespace corpus {
+
+namespace {
+
+// xorshift32, fixed so the corpora never change between builds.
+class Random {
+public:
+	Random(uint32_t seed) : x(seed != 0 ? seed : 1) {}
+	uint32_t Next() {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+	// returns a value in [0, n).
+	uint32_t Below(uint32_t n) { return Next() % n; }
+private:
+	uint32_t x;
+};
+
+std::string Ident(Random *r) {
+	std::string s;
+	int n = 1 + r->Below(8);
+	for (int i = 0; i < n; i++) {
+		s.push_back('a' + r->Below(26));
+	}
+	return s;
+}
+
+std::string UnicodeIdent(Random *r) {
+	// first code point and size of a run of letters per script.
+	static const struct { char32_t first, n; } scripts[] = {
+		{'a', 26}, {0x03B1, 25}, {0x0430, 32}, {0x4E00, 0x5000},
+	};
+	auto script = scripts[r->Below(4)];
+	std::string s;
+	int n = 1 + r->Below(8);
+	for (int i = 0; i < n; i++) {
+		char32_t c = script.first + r->Below(script.n);
+		if (c < 0x80) {
+			s.push_back(c);
+		} else if (c < 0x800) {
+			s.push_back(0xC0 | (c >> 6));
+			s.push_back(0x80 | (c & 0x3F));
+		} else {
+			s.push_back(0xE0 | (c >> 12));
+			s.push_back(0x80 | ((c >> 6) & 0x3F));
+			s.push_back(0x80 | (c & 0x3F));
+		}
+	}
+	return s;
+}
+
+} // namespace
+
+std::string DeepNesting(int depth) {
+	return "(quote " + std::string(depth, '(') + "x" + std::string(depth, ')') + ")\n";
+}
+
+std::string WideList(int n, uint32_t seed) {
+	Random r(seed);
+	std::string s = "(quote (";
+	for (int i = 0; i < n; i++) {
+		if (i != 0) {
+			s += ' ';
+		}
+		switch (r.Below(3)) {
+		case 0:
+			s += Ident(&r);
+			break;
+		case 1:
+			s += std::to_string(r.Below(100000));
+			break;
+		default:
+			s += '"' + Ident(&r) + '"';
+		}
+	}
+	return s + "))\n";
+}
+
+std::string UnicodeList(int n, uint32_t seed) {
+	Random r(seed);
+	std::string s = "(quote (";
+	for (int i = 0; i < n; i++) {
+		if (i != 0) {
+			s += ' ';
+		}
+		if (r.Below(2) == 0) {
+			s += UnicodeIdent(&r);
+		} else {
+			s += '"' + UnicodeIdent(&r) + '"';
+		}
+	}
+	return s + "))\n";
+}
+
+std::string LongStrings(int n, int length, uint32_t seed) {
+	Random r(seed);
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += "(quote \"";
+		for (int j = 0; j < length; j++) {
+			s.push_back('a' + r.Below(26));
+		}
+		s += "\")\n";
+	}
+	return s;
+}
+
+std::string NestedLambdas(int n, int depth) {
+	// ((lambda x ((lambda x ... x) 1)) 1)
+	std::string form = "x";
+	for (int i = 0; i < depth; i++) {
+		form = "((lambda x " + form + ") " + std::to_string(i) + ")";
+	}
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += form + "\n";
+	}
+	return s;
+}
+
+std::string Calls(int n, uint32_t seed) {
+	Random r(seed);
+	const char *ops[] = {"+", "-", "*"};
+	std::string s;
+	for (int i = 0; i < n; i++) {
+		s += std::string("(") + ops[r.Below(3)] + " " + std::to_string(r.Below(100));
+		s += std::string(" (") + ops[r.Below(3)] + " " + std::to_string(r.Below(100)) + " " + std::to_string(r.Below(100)) + "))\n";
+	}
+	return s;
+}
+
+} // namespace corpus
+} // namespace crisp
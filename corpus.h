@@ -0,0 +1,40 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_CORPUS_H_
+#define CRISP_CORPUS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace crisp {
+namespace corpus {
+
+// generators of crisp source for benchmarks.
+// output depends only on the arguments, so runs on different
+// commits measure the same input.
+
+// returns a quoted list of n identifiers and strings, a third of
+// them ASCII and the rest in Greek, Cyrillic and CJK.
+std::string UnicodeList(int n, uint32_t seed);
+
+// returns n nested lists around an atom: (((... x ...))).
+std::string DeepNesting(int depth);
+
+// returns a quoted list of n mixed atoms.
+std::string WideList(int n, uint32_t seed);
+
+// returns n quoted strings of length bytes each.
+std::string LongStrings(int n, int length, uint32_t seed);
+
+// returns n forms applying depth nested lambdas to a number.
+std::string NestedLambdas(int n, int depth);
+
+// returns n builtin calls over numbers, such as (+ 1 (* 2 3)).
+std::string Calls(int n, uint32_t seed);
+
+} // namespace corpus
+} // namespace crisp
+
+#endif // CRISP_CORPUS_H_
@@ -0,0 +1,104 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "expand.h"
+
+namespace crisp {
+
+Node *Expander::Run(Node *node) {
+	auto root = dynamic_cast<ParentNode *>(node);
+	if (root == nullptr) {
+		return node;
+	}
+
+	Scan(node);
+	ParentNode *out = new RootNode();
+	for (auto i: root->children()) {
+		auto l = dynamic_cast<ListNode *>(i);
+		if (l != nullptr && !l->children().empty() && IsForm(l->children()[0], "defmacro")) {
+			// defined now for the forms that follow,
+			// and again when the program runs.
+			l->Eval(state);
+			out->Put(i);
+			continue;
+		}
+		out->Put(Rewrite(i, 0));
+	}
+	return out;
+}
+
+void Expander::Scan(Node *node) {
+	auto l = dynamic_cast<ParentNode *>(node);
+	if (l == nullptr) {
+		return;
+	}
+	auto& c = l->children();
+	if (c.size() >= 2) {
+		auto head = dynamic_cast<IdentNode *>(c[0]);
+		auto id = dynamic_cast<IdentNode *>(c[1]);
+		if (head != nullptr && id != nullptr && head->str() == "lambda") {
+			params.insert(id->str());
+		}
+	}
+	for (auto i: c) {
+		Scan(i);
+	}
+}
+
+bool Expander::IsForm(Node *node, const std::string& id) const {
+	auto i = dynamic_cast<IdentNode *>(node);
+	return i != nullptr && i->str() == id && params.count(id) == 0;
+}
+
+MacroNode *Expander::Macro(Node *head) const {
+	auto id = dynamic_cast<IdentNode *>(head);
+	if (id == nullptr || params.count(id->str()) != 0) {
+		return nullptr;
+	}
+	return dynamic_cast<MacroNode *>(state->symbol_table()->Get(id->str()));
+}
+
+Node *Expander::Rewrite(Node *node, int depth) {
+	auto l = dynamic_cast<ListNode *>(node);
+	if (l == nullptr || l->children().empty()) {
+		return node;
+	}
+	auto d = done.find(node);
+	if (d != done.end()) {
+		return d->second;
+	}
+	auto& c = l->children();
+	if (IsForm(c[0], "quote") || IsForm(c[0], "defmacro")) {
+		return node;
+	}
+
+	Node *result = node;
+	if (MacroNode *macro = Macro(c[0])) {
+		std::vector<Node *> args(c.begin() + 1, c.end());
+		Node *tree = depth < kMaxDepth ? macro->Expand(args) : nullptr;
+		// errors are left to be reported at run time.
+		if (tree != nullptr && dynamic_cast<ErrorNode *>(tree) == nullptr) {
+			expansions_++;
+			result = Rewrite(tree, depth + 1);
+		}
+	} else {
+		std::vector<Node *> out = c;
+		// only the body of a lambda is an expression.
+		std::size_t first = IsForm(c[0], "lambda") ? 2 : 0;
+		for (std::size_t i = first; i < out.size(); i++) {
+			out[i] = Rewrite(out[i], depth);
+		}
+		if (out != c) {
+			auto list = new ListNode();
+			for (auto i: out) {
+				list->Put(i);
+			}
+			result = list;
+		}
+	}
+	done[node] = result;
+	return result;
+}
+
+} // namespace crisp
@@ -0,0 +1,60 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_EXPAND_H_
+#define CRISP_EXPAND_H_
+
+#include "tree.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace crisp {
+
+// Expander replaces macro calls in a parsed tree before evaluation.
+// top level defmacro forms are evaluated as they are reached, so a
+// macro may be used by the forms after it. each call site is expanded
+// once, and sites shared by a hash consed tree are expanded together.
+//
+// like the optimizer, it leaves alone any name bound as a lambda
+// parameter anywhere in the program. macros it cannot see, such as
+// those defined inside lambdas, are expanded by the evaluator when
+// their call sites first run.
+class Expander {
+public:
+	Expander(Node::State *s) : state(s) {}
+
+	// returns a copy of root with macro calls expanded,
+	// root itself is not modified.
+	Node *Run(Node *root);
+
+	// returns the number of call sites expanded by Run.
+	int expansions() const { return expansions_; }
+private:
+	// expansions that keep producing macro calls are left
+	// to fail at run time past this depth.
+	static const int kMaxDepth = 256;
+
+	// records the names bound by lambda under node.
+	void Scan(Node *node);
+
+	Node *Rewrite(Node *node, int depth);
+
+	// returns the macro head names, or nullptr.
+	MacroNode *Macro(Node *head) const;
+
+	// returns true if node is the identifier of a form that has not been rebound.
+	bool IsForm(Node *node, const std::string& id) const;
+
+	Node::State *state;
+	std::set<std::string> params;
+	// rewritten lists by the list they were rewritten from.
+	std::map<Node *, Node *> done;
+	int expansions_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_EXPAND_H_
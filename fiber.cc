@@ -0,0 +1,152 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "fiber.h"
+#include "fuel.h"
+#include "heap.h"
+#include "io.h"
+#include "tree.h"
+
+#include <sys/mman.h>
+
+namespace crisp {
+
+namespace {
+
+thread_local Fiber *current_fiber = nullptr;
+
+// thread locals are read through these so that the compiler cannot
+// reuse a thread local's address across a switch to another thread.
+__attribute__((noinline)) Fiber *GetCurrent() {
+	return current_fiber;
+}
+
+__attribute__((noinline)) void SetCurrent(Fiber *f) {
+	current_fiber = f;
+}
+
+} // namespace
+
+Fiber::Fiber(WorkerPool *p, Body b, std::size_t size) : pool(p), body(b), stack_size(size), done_(false), heap_(Heap::Current()), output_(Output::Current()->shared_from_this()), profile_(Profiler::Spawned()) {
+	if (heap_ != nullptr) {
+		heap_->Pin();
+	}
+	if (ScopeObserver *o = ScopeObserver::Current()) {
+		observer_ = o->shared_from_this();
+	}
+	stack = static_cast<char *>(mmap(nullptr, stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+	getcontext(&context);
+	context.uc_stack.ss_sp = stack;
+	context.uc_stack.ss_size = stack_size;
+	context.uc_link = &caller;
+	makecontext(&context, &Fiber::Entry, 0);
+}
+
+Fiber *Fiber::Spawn(WorkerPool *pool, Body body, std::size_t stack_size) {
+	Fiber *f = new Fiber(pool, body, stack_size);
+	f->Ready();
+	return f;
+}
+
+void Fiber::SpawnDetached(WorkerPool *pool, Body body, std::size_t stack_size) {
+	Fiber *f = new Fiber(pool, body, stack_size);
+	f->detached_ = true;
+	f->Ready();
+}
+
+Fiber *Fiber::Current() {
+	return GetCurrent();
+}
+
+void Fiber::Entry() {
+	Fiber *f = GetCurrent();
+	f->body();
+	f->body = nullptr;
+	f->done_ = true;
+	// returns to caller through uc_link.
+}
+
+void Fiber::Resume() {
+	Fiber *prev = GetCurrent();
+	SetCurrent(this);
+	Profiler::Context thread_profile = Profiler::Swap(profile_);
+	if (meter_ != nullptr) {
+		meter_->Enter();
+	}
+	{
+		Heap::Use use(heap_);
+		Output::Use out(output_.get());
+		ScopeObserver::Use observe(observer_.get());
+		swapcontext(&caller, &context);
+	}
+	if (meter_ != nullptr) {
+		meter_->Leave();
+	}
+	profile_ = Profiler::Swap(thread_profile);
+	SetCurrent(prev);
+
+	if (unlock_after_switch != nullptr) {
+		std::mutex *m = unlock_after_switch;
+		unlock_after_switch = nullptr;
+		m->unlock();
+	}
+	if (ready_after_switch) {
+		ready_after_switch = false;
+		Ready();
+	}
+	if (done_) {
+		munmap(stack, stack_size);
+		stack = nullptr;
+		if (heap_ != nullptr) {
+			heap_->Unpin();
+			heap_ = nullptr;
+		}
+		if (detached_) {
+			delete this;
+		}
+	}
+}
+
+void Fiber::Ready() {
+	pool->Submit([this]() { Resume(); });
+}
+
+void Fiber::Park(std::unique_lock<std::mutex>& lock) {
+	Fiber *f = GetCurrent();
+	std::mutex *m = lock.release();
+	f->unlock_after_switch = m;
+	swapcontext(&f->context, &f->caller);
+	lock = std::unique_lock<std::mutex>(*m);
+}
+
+void Fiber::Yield() {
+	Fiber *f = GetCurrent();
+	f->ready_after_switch = true;
+	swapcontext(&f->context, &f->caller);
+}
+
+void Waiter::Wake() {
+	std::lock_guard<std::mutex> lock(mut);
+	woken = true;
+	if (parked) {
+		parked = false;
+		fiber->Ready();
+	} else if (fiber == nullptr) {
+		cond.notify_one();
+	}
+}
+
+void Waiter::Wait() {
+	std::unique_lock<std::mutex> lock(mut);
+	while (!woken) {
+		if (fiber != nullptr) {
+			parked = true;
+			Fiber::Park(lock);
+		} else {
+			cond.wait(lock);
+		}
+	}
+}
+
+} // namespace crisp
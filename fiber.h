@@ -0,0 +1,131 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_FIBER_H_
+#define CRISP_FIBER_H_
+
+#include "pool.h"
+#include "profile.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <ucontext.h>
+
+namespace crisp {
+
+class Heap;
+class Meter;
+class Output;
+class ScopeObserver;
+
+// Fiber is a coroutine with its own stack, run by the tasks of a
+// WorkerPool. A fiber that parks gives its worker back to the pool and
+// is resumed, on any worker, once it is made ready again.
+class Fiber {
+public:
+	typedef std::function<void()> Body;
+
+	// stacks are reserved lazily by the kernel, so a generous
+	// size costs only the pages a fiber actually touches.
+	static const std::size_t kDefaultStackSize = 256 * 1024;
+
+	// starts body on a new fiber.
+	static Fiber *Spawn(WorkerPool *pool, Body body, std::size_t stack_size = kDefaultStackSize);
+	// starts body on a new fiber that is deleted once body returns,
+	// for fibers no one refers to from outside.
+	static void SpawnDetached(WorkerPool *pool, Body body, std::size_t stack_size = kDefaultStackSize);
+
+	// returns the fiber running on this thread or nullptr.
+	static Fiber *Current();
+
+	// suspends the current fiber until Ready is called.
+	// lock is released once the fiber has switched away, so a waker
+	// holding the same mutex cannot resume it early,
+	// and is reacquired when the fiber resumes.
+	static void Park(std::unique_lock<std::mutex>& lock);
+
+	// schedules a parked fiber to resume.
+	void Ready();
+
+	// lets other queued work run before the current fiber continues.
+	static void Yield();
+
+	// the meter charged for the fiber's work, or nullptr.
+	// a meter is told when the fiber starts and stops running.
+	Meter *meter() const { return meter_; }
+	void set_meter(Meter *m) { meter_ = m; }
+
+	bool done() const { return done_; }
+	// returns the lowest address of the fiber's stack.
+	const char *stack_bottom() const { return stack; }
+private:
+	Fiber(WorkerPool *pool, Body body, std::size_t stack_size);
+
+	// runs the fiber on the calling thread until it parks or returns.
+	void Resume();
+	static void Entry();
+
+	WorkerPool *pool;
+	Body body;
+	ucontext_t context;
+	ucontext_t caller;
+	char *stack;
+	std::size_t stack_size;
+	std::mutex *unlock_after_switch = nullptr;
+	bool ready_after_switch = false;
+	Meter *meter_ = nullptr;
+	bool detached_ = false;
+	std::atomic<bool> done_;
+	// the heap the fiber was spawned from, current while it runs
+	// and pinned until it is done.
+	Heap *heap_;
+	// the output the fiber was spawned with, current while it runs.
+	// it is shared, the fiber may outlive whoever made it current.
+	std::shared_ptr<Output> output_;
+	// the scope observer the fiber was spawned with, if any.
+	std::shared_ptr<ScopeObserver> observer_;
+	// the fiber's profiler context, swapped in while it runs.
+	Profiler::Context profile_;
+};
+
+// Waiter is a fiber or thread blocked on a channel operation.
+// Only the party that claims a waiter may complete its operation.
+struct Waiter {
+	Waiter() : fiber(Fiber::Current()), claimed(false) {}
+
+	// returns true if the caller now owns the waiter's operation.
+	bool Claim() {
+		bool expected = false;
+		return claimed.compare_exchange_strong(expected, true);
+	}
+
+	// wakes the waiter once its operation is complete.
+	void Wake();
+
+	// blocks until woken, parking if called on a fiber.
+	void Wait();
+
+	Fiber *fiber;
+	std::atomic<bool> claimed;
+
+	// the item being sent or received, and the index of the channel
+	// that completed the operation.
+	void *slot = nullptr;
+	int index = 0;
+private:
+	std::mutex mut;
+	std::condition_variable cond;
+	bool woken = false;
+	// set while the fiber is parked. a waker that gets in before the
+	// fiber parks only sets woken, so the fiber is never readied twice.
+	bool parked = false;
+};
+
+} // namespace crisp
+
+#endif // CRISP_FIBER_H_
@@ -0,0 +1,114 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "pool.h"
+#include "fiber.h"
+#include "channel.h"
+#include "parser.h"
+#include "tree.h"
+
+#include <atomic>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace crisp;
+
+namespace {
+
+const int kPairs = 50;
+const int kRounds = 2000;
+
+std::atomic<int> failures(0);
+
+void Check(bool ok, const char *what, int pair, int round) {
+	if (!ok) {
+		failures++;
+		fprintf(stderr, "pair %d round %d: %s\n", pair, round, what);
+	}
+}
+
+// pairs of fibers bounce a counter over unbuffered channels, the replies
+// alternating between two channels the pinger selects over. wakers race
+// the waiter parking on every round.
+bool PingPong() {
+	WorkerPool pool(8);
+	std::atomic<int> done(0);
+	std::vector<FiberChannel<int> *> chans;
+	for (int p = 0; p < kPairs; p++) {
+		auto ping = new FiberChannel<int>(0);
+		auto even = new FiberChannel<int>(0);
+		auto odd = new FiberChannel<int>(0);
+		chans.insert(chans.end(), {ping, even, odd});
+
+		Fiber::Spawn(&pool, [ping, even, odd, p, &done]() {
+			std::vector<FiberChannel<int> *> replies = {even, odd};
+			for (int i = 0; i < kRounds; i++) {
+				ping->Put(i);
+				int v = -1;
+				int index = FiberChannel<int>::Select(replies, &v);
+				Check(index == i % 2, "reply on the wrong channel", p, i);
+				Check(v == i + 1, "wrong reply", p, i);
+			}
+			done++;
+		});
+		Fiber::Spawn(&pool, [ping, even, odd, &done]() {
+			for (int i = 0; i < kRounds; i++) {
+				int v = ping->Get();
+				(i % 2 == 0 ? even : odd)->Put(v + 1);
+			}
+			done++;
+		});
+	}
+	pool.HelpUntil([&done]() { return done == 2 * kPairs; });
+	for (auto c: chans) {
+		delete c;
+	}
+	return failures == 0;
+}
+
+// returns the printed value of the last form of script.
+std::string EvalLast(const std::string& script) {
+	Node::State state;
+	std::istringstream in(script);
+	auto tree = static_cast<ParentNode *>(parser::Parse(&in, false));
+	Node *value = nullptr;
+	for (auto i: tree->children()) {
+		value = i->Eval(&state);
+	}
+	return value != nullptr ? value->PPrint() : "";
+}
+
+// a defined channel is made once, so the sender and receiver
+// share it rather than each making their own and blocking forever.
+bool DefinedChannel() {
+	bool ok = true;
+	std::string v = EvalLast("(def c (make-chan)) (spawn (send c 42)) (recv c)");
+	if (v != "42") {
+		fprintf(stderr, "defined channel: got '%s'\n", v.c_str());
+		ok = false;
+	}
+	v = EvalLast("(def a (make-chan 1)) (def b (make-chan 1)) (send b 7) (select a b)");
+	if (v != "(1 7)") {
+		fprintf(stderr, "select over defined channels: got '%s'\n", v.c_str());
+		ok = false;
+	}
+	return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	if (!PingPong()) {
+		fprintf(stderr, "FAIL ping-pong: %d failures\n", failures.load());
+		return 1;
+	}
+	if (!DefinedChannel()) {
+		fprintf(stderr, "FAIL defined channel\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
@@ -0,0 +1,247 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "fuel.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace crisp {
+
+namespace {
+
+const uint64_t kUnlimited = std::numeric_limits<uint64_t>::max();
+
+// steps between checks of the allocation budget.
+const uint64_t kAllocationCheck = 1024;
+
+// metered fibers evaluate deeply recursive code on their own stack.
+const std::size_t kMeteredStackSize = 8 * 1024 * 1024;
+// stack kept free for builtins called by a step.
+const std::size_t kStackReserve = 256 * 1024;
+
+// the meter of handed off work running on this thread off any fiber.
+thread_local Meter *task_meter = nullptr;
+
+} // namespace
+
+Meter::Meter(uint64_t steps, uint64_t allocations, bool yield)
+	: steps_(steps == 0 ? kUnlimited : steps), allocations_(allocations), yield_(yield),
+	quantum_(steps == 0 ? kUnlimited : steps) {}
+
+Meter::Meter(std::shared_ptr<Budget> budget)
+	: steps_(kUnlimited), allocations_(0), yield_(false), quantum_(kUnlimited), budget_(budget), owner_(false) {}
+
+Meter *Meter::Current() {
+	Fiber *f = Fiber::Current();
+	return f != nullptr ? f->meter() : task_meter;
+}
+
+Meter::Shared Meter::Share() {
+	Shared shared;
+	Meter *m = Current();
+	if (m == nullptr || m->yield_) {
+		return shared;
+	}
+	if (m->budget_ == nullptr) {
+		m->budget_ = std::make_shared<Budget>();
+	}
+	if (m->owner_) {
+		// the owner checks its budget often from now on,
+		// so what it and its handed off work use adds up.
+		m->Publish(m->allocations_used());
+		m->limit_ = std::min(m->limit_, m->steps_used_ + kAllocationCheck);
+	}
+	shared.budget = m->budget_;
+	return shared;
+}
+
+Meter::Use::Use(const Shared& shared) : prev(nullptr), fiber(Fiber::Current()) {
+	if (shared.budget == nullptr) {
+		return;
+	}
+	meter.reset(new Meter(shared.budget));
+	prev = fiber != nullptr ? fiber->meter() : task_meter;
+	if (prev != nullptr) {
+		// work run in place keeps to the stack it is on.
+		meter->stack_limit_ = prev->stack_limit_;
+		prev->Leave();
+	}
+	if (fiber != nullptr) {
+		fiber->set_meter(meter.get());
+	} else {
+		task_meter = meter.get();
+	}
+	meter->Enter();
+}
+
+Meter::Use::~Use() {
+	if (meter == nullptr) {
+		return;
+	}
+	meter->Leave();
+	// charges the steps since the last check.
+	meter->Charge();
+	if (fiber != nullptr) {
+		fiber->set_meter(prev);
+	} else {
+		task_meter = prev;
+	}
+	if (prev != nullptr) {
+		prev->Enter();
+	}
+}
+
+void Meter::Enter() {
+	allocation_base_ = node_allocations;
+}
+
+void Meter::Leave() {
+	allocated_ += node_allocations - allocation_base_;
+	allocation_base_ = node_allocations;
+}
+
+uint64_t Meter::allocations_used() const {
+	// only valid on the fiber, the count since Enter is per thread.
+	return allocated_ + (node_allocations - allocation_base_);
+}
+
+bool Meter::Exhausted() {
+	if (static_cast<const char *>(__builtin_frame_address(0)) <= stack_limit_) {
+		steps_used_--;
+		failure_ = "stack exhausted";
+		return false;
+	}
+	if (!owner_) {
+		return Charge();
+	}
+	for (;;) {
+		if (cancelled_) {
+			limit_ = 0;
+			failure_ = "evaluation cancelled";
+			return false;
+		}
+		uint64_t allocated = allocations_used();
+		uint64_t steps = steps_used_, allocations = allocated;
+		if (budget_ != nullptr) {
+			Publish(allocated);
+			steps += budget_->steps;
+			allocations += budget_->allocations;
+		}
+		bool out = steps > steps_ || (allocations_ != 0 && allocations > allocations_);
+		if (!out) {
+			bool often = allocations_ != 0 || budget_ != nullptr;
+			limit_ = often ? std::min(steps_, steps_used_ + kAllocationCheck) : steps_;
+			return true;
+		}
+		if (yield_) {
+			// a yielding meter grants itself a fresh quantum.
+			steps_ = steps_used_ + quantum_;
+			if (allocations_ != 0) {
+				allocations_ = allocated + allocations_;
+			}
+			Fiber::Yield();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mut);
+		exhausted_ = true;
+		cond.notify_all();
+		while (exhausted_) {
+			Fiber::Park(lock);
+		}
+	}
+}
+
+bool Meter::Charge() {
+	uint64_t allocated = allocations_used();
+	uint64_t steps = budget_->steps += steps_used_ - charged_steps_;
+	uint64_t allocations = budget_->allocations += allocated - charged_allocations_;
+	charged_steps_ = steps_used_;
+	charged_allocations_ = allocated;
+	uint64_t allocation_limit = budget_->allocation_limit;
+	if (budget_->cancelled) {
+		limit_ = 0;
+		failure_ = "evaluation cancelled";
+		return false;
+	}
+	if (budget_->owner_steps + steps > budget_->step_limit ||
+		(allocation_limit != 0 && budget_->owner_allocations + allocations > allocation_limit)) {
+		// handed off work does not park, it fails so that it unwinds.
+		limit_ = 0;
+		failure_ = "fuel exhausted";
+		return false;
+	}
+	limit_ = steps_used_ + kAllocationCheck;
+	return true;
+}
+
+void Meter::Publish(uint64_t allocated) {
+	budget_->owner_steps = steps_used_;
+	budget_->owner_allocations = allocated;
+	budget_->step_limit = steps_;
+	budget_->allocation_limit = allocations_;
+}
+
+MeteredEval::MeteredEval(WorkerPool *pool, Node *node, Node::State *state, uint64_t steps, uint64_t allocations, bool yield, Done done)
+	: meter_(steps, allocations, yield) {
+	Fiber::SpawnDetached(pool, [this, node, state, done]() {
+		Fiber *f = Fiber::Current();
+		meter_.fiber = f;
+		meter_.stack_limit_ = f->stack_bottom() + kStackReserve;
+		f->set_meter(&meter_);
+		meter_.Enter();
+		Node *result = node->Eval(state);
+		// the meter may be gone once Wait returns.
+		f->set_meter(nullptr);
+		{
+			std::lock_guard<std::mutex> lock(meter_.mut);
+			result_ = result;
+			done_ = true;
+			meter_.cond.notify_all();
+		}
+		if (done) {
+			done(result);
+		}
+	}, kMeteredStackSize);
+}
+
+MeteredEval::Status MeteredEval::Wait() {
+	std::unique_lock<std::mutex> lock(meter_.mut);
+	while (!done_ && !meter_.exhausted_) {
+		meter_.cond.wait(lock);
+	}
+	return done_ ? kDone : kExhausted;
+}
+
+void MeteredEval::Refuel(uint64_t steps, uint64_t allocations) {
+	std::lock_guard<std::mutex> lock(meter_.mut);
+	if (!meter_.exhausted_) {
+		return;
+	}
+	meter_.steps_ += steps;
+	if (meter_.allocations_ != 0) {
+		meter_.allocations_ += allocations;
+	}
+	if (meter_.budget_ != nullptr) {
+		meter_.budget_->step_limit = meter_.steps_;
+		meter_.budget_->allocation_limit = meter_.allocations_;
+	}
+	meter_.exhausted_ = false;
+	meter_.fiber->Ready();
+}
+
+void MeteredEval::Cancel() {
+	std::lock_guard<std::mutex> lock(meter_.mut);
+	if (!meter_.exhausted_) {
+		return;
+	}
+	meter_.cancelled_ = true;
+	if (meter_.budget_ != nullptr) {
+		meter_.budget_->cancelled = true;
+	}
+	meter_.exhausted_ = false;
+	meter_.fiber->Ready();
+}
+
+} // namespace crisp
@@ -0,0 +1,186 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_FUEL_H_
+#define CRISP_FUEL_H_
+
+#include "tree.h"
+#include "fiber.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace crisp {
+
+// Meter bounds the work of an evaluation running on a fiber. Every
+// call the evaluator makes is a step, and nodes allocated are counted
+// against an optional allocation budget. A budget of 0 is unlimited.
+//
+// When a budget runs out a yielding meter grants itself another
+// quantum and gives its worker to other fibers. Otherwise the fiber
+// parks and the evaluation is exhausted: it may be refueled to resume
+// where it stopped, or cancelled, which makes every later step fail so
+// the evaluation unwinds by returning errors. Steps also fail while
+// the fiber's stack is nearly full, so runaway recursion unwinds with
+// errors rather than overflowing the stack.
+//
+// Work that parallel builtins hand off to the pool or to new fibers is
+// metered too, each task under a meter of its own that charges the
+// budget of the evaluation it came from. Its steps fail, rather than
+// park, once that budget is spent or the evaluation is cancelled.
+class Meter {
+	struct Budget;
+public:
+	Meter(uint64_t steps, uint64_t allocations, bool yield);
+
+	// returns the meter of the running fiber, or of the handed off
+	// work running on this thread, or nullptr.
+	static Meter *Current();
+
+	// Shared is a handle to the budget handed off work is charged to,
+	// empty if the work is not metered.
+	class Shared {
+	private:
+		friend class Meter;
+		std::shared_ptr<Budget> budget;
+	};
+
+	// returns a handle to the current meter's budget, to be taken before
+	// handing off work. the handle is empty if there is no meter or if
+	// it yields, as a yielding meter bounds nothing.
+	static Shared Share();
+
+	// Use meters handed off work for its lifetime, making a meter
+	// charged to shared's budget current on this fiber or thread.
+	class Use {
+	public:
+		explicit Use(const Shared& shared);
+		~Use();
+
+		// deleted copy and move constructor.
+		Use(const Use&) = delete;
+		Use(Use&&) = delete;
+	private:
+		std::unique_ptr<Meter> meter;
+		Meter *prev;
+		Fiber *fiber;
+	};
+
+	// charges one step, returns false once cancelled
+	// or out of stack, as told by failure.
+	bool Step() {
+		if (++steps_used_ <= limit_ && static_cast<const char *>(__builtin_frame_address(0)) > stack_limit_) {
+			return true;
+		}
+		return Exhausted();
+	}
+	const char *failure() const { return failure_; }
+
+	// called by the fiber as it starts or stops running on a thread.
+	void Enter();
+	void Leave();
+
+	uint64_t steps_used() const { return steps_used_; }
+	uint64_t allocations_used() const;
+private:
+	friend class MeteredEval;
+
+	// the use of a budget by the meter that owns it and by the meters
+	// of work handed off from its evaluation.
+	struct Budget {
+		std::atomic<uint64_t> steps{0};
+		std::atomic<uint64_t> allocations{0};
+		// the owner's own use, published as it checks its budgets.
+		std::atomic<uint64_t> owner_steps{0};
+		std::atomic<uint64_t> owner_allocations{0};
+		std::atomic<uint64_t> step_limit{0};
+		std::atomic<uint64_t> allocation_limit{0};
+		std::atomic<bool> cancelled{false};
+	};
+
+	// a meter for handed off work, charged to budget.
+	explicit Meter(std::shared_ptr<Budget> budget);
+
+	// the slow path of Step, checks budgets and parks or yields.
+	bool Exhausted();
+	// the slow path of a meter charged to another's budget.
+	bool Charge();
+	// publishes the owner's use and limits to budget_.
+	void Publish(uint64_t allocated);
+
+	uint64_t steps_;
+	uint64_t allocations_;
+	const bool yield_;
+	// the quantum granted to yielding meters.
+	const uint64_t quantum_;
+
+	// steps may run without checking the budgets until this many are used.
+	uint64_t limit_ = 0;
+	uint64_t steps_used_ = 0;
+	uint64_t allocated_ = 0;
+	unsigned long allocation_base_ = 0;
+	bool cancelled_ = false;
+	const char *failure_ = nullptr;
+	// steps fail below this address.
+	const char *stack_limit_ = nullptr;
+
+	// shared with handed off work once any is, owner_ if this meter
+	// is the evaluation's own rather than a handed off one's.
+	std::shared_ptr<Budget> budget_;
+	bool owner_ = true;
+	// what a handed off meter has charged to budget_ so far.
+	uint64_t charged_steps_ = 0;
+	uint64_t charged_allocations_ = 0;
+
+	// set while parked for want of fuel, guarded by mut.
+	bool exhausted_ = false;
+	std::mutex mut;
+	std::condition_variable cond;
+	Fiber *fiber = nullptr;
+};
+
+// MeteredEval evaluates a node on a new fiber under a meter.
+class MeteredEval {
+public:
+	enum Status {
+		kDone,
+		kExhausted,
+	};
+
+	// done, if set, is called on the fiber with the result once the
+	// evaluation is over, and the MeteredEval may be deleted from then on.
+	typedef std::function<void(Node *result)> Done;
+
+	MeteredEval(WorkerPool *pool, Node *node, Node::State *state, uint64_t steps, uint64_t allocations = 0, bool yield = false, Done done = nullptr);
+
+	// deleted copy and move constructor.
+	MeteredEval(const MeteredEval&) = delete;
+	MeteredEval(MeteredEval&&) = delete;
+
+	// blocks until the evaluation is done or exhausted.
+	Status Wait();
+
+	// adds to the budgets of an exhausted evaluation and resumes it.
+	void Refuel(uint64_t steps, uint64_t allocations = 0);
+
+	// fails the remaining steps of an exhausted evaluation and resumes
+	// it so that it unwinds, Wait then returns kDone.
+	void Cancel();
+
+	// returns the result once done.
+	Node *result() const { return result_; }
+	const Meter& meter() const { return meter_; }
+private:
+	Meter meter_;
+	Node *result_ = nullptr;
+	bool done_ = false;
+};
+
+} // namespace crisp
+
+#endif // CRISP_FUEL_H_
@@ -1,19 +1,171 @@
 
 #include "functions.h"
+#include "fuel.h"
+#include "heap.h"
+#include "io.h"
+#include "mapped.h"
+#include "module.h"
+#include "pool.h"
+#include "printer.h"
+#include "utf8.h"
 
 namespace crisp {
 
+namespace {
+
+// evaluates params as numbers into nums,
+// returning an ErrorNode if one is not a number.
+Node *EvalNums(Node::State *state, const std::string& name, std::vector<Node *>& params, std::vector<int> *nums) {
+	for (auto i: params) {
+		Node *n = i->Eval(state);
+		auto num = dynamic_cast<NumNode *>(n);
+		if (num == nullptr) {
+			return new ErrorNode(name + ": arguments must be numbers not '" + n->PPrint() + "'");
+		}
+		nums->push_back(num->num());
+	}
+	return nullptr;
+}
+
+// returns true if node calls a builtin that creates a runtime object.
+// the callee is looked up, not evaluated, so nothing else runs.
+bool CallsCreator(Node::State *state, Node *node) {
+	auto l = dynamic_cast<ListNode *>(node);
+	if (l == nullptr || l->children().empty()) {
+		return false;
+	}
+	auto id = dynamic_cast<IdentNode *>(l->children()[0]);
+	if (id == nullptr) {
+		return false;
+	}
+	auto call = dynamic_cast<CallNode *>(state->symbol_table()->Get(id->str()));
+	return call != nullptr && call->Creates();
+}
+
+// collects the elements of seq into items,
+// returning an ErrorNode if a stage fails.
+Node *Realize(Node::State *state, SeqNode *seq, std::vector<Node *> *items) {
+	return seq->ForEach(state, [items](Node *n) {
+		items->push_back(n);
+		return true;
+	});
+}
+
+// lists shorter than two grains are mapped sequentially.
+const std::size_t kParallelGrain = 16;
+
+// evaluates a callable and a list argument for the parallel builtins.
+// returns an ErrorNode on failure.
+Node *EvalCallAndList(Node::State *state, const std::string& name, Node *f, Node *l, CallableNode **func, std::vector<Node *> *items) {
+	Node *fn = f->Eval(state);
+	*func = dynamic_cast<CallableNode *>(fn);
+	if (*func == nullptr) {
+		return new ErrorNode(name + ": first atom must be Callable not '" + fn->PPrint() + "'");
+	}
+	Node *list = l->Eval(state);
+	if (auto ln = dynamic_cast<ListNode *>(list)) {
+		*items = ln->children();
+	} else if (auto vl = dynamic_cast<VListNode *>(list)) {
+		*items = vl->list().ToVector();
+	} else if (auto seq = dynamic_cast<SeqNode *>(list)) {
+		return Realize(state, seq, items);
+	} else if (dynamic_cast<NullNode *>(list) == nullptr) {
+		return new ErrorNode(name + ": expected a List not '" + list->PPrint() + "'");
+	}
+	return nullptr;
+}
+
+// evaluates param as a list into list,
+// returning an ErrorNode if it is not one.
+Node *EvalList(Node::State *state, const std::string& name, Node *param, VList *list) {
+	Node *n = param->Eval(state);
+	if (auto v = dynamic_cast<VListNode *>(n)) {
+		*list = v->list();
+	} else if (auto l = dynamic_cast<ListNode *>(n)) {
+		// syntax lists are copied into a chunk once.
+		*list = VList::FromVector(l->children());
+	} else if (auto seq = dynamic_cast<SeqNode *>(n)) {
+		std::vector<Node *> items;
+		if (Node *err = Realize(state, seq, &items)) {
+			return err;
+		}
+		*list = VList::FromVector(items);
+	} else if (dynamic_cast<NullNode *>(n) != nullptr) {
+		*list = VList();
+	} else {
+		return new ErrorNode(name + ": expected a List not '" + n->PPrint() + "'");
+	}
+	return nullptr;
+}
+
+// evaluates params as strings into strs,
+// returning an ErrorNode if one is not a string.
+Node *EvalStrings(Node::State *state, const std::string& name, std::vector<Node *>& params, std::vector<SharedString> *strs) {
+	for (auto i: params) {
+		Node *n = i->Eval(state);
+		auto s = dynamic_cast<StringNode *>(n);
+		if (s == nullptr) {
+			return new ErrorNode(name + ": arguments must be strings not '" + n->PPrint() + "'");
+		}
+		strs->push_back(s->str());
+	}
+	return nullptr;
+}
+
+// returns list as a node, empty lists are null.
+Node *ListValue(const VList& list) {
+	if (list.empty()) {
+		return new NullNode();
+	}
+	return new VListNode(list);
+}
+
+// calls func with the given argument values.
+Node *Apply(Node::State *state, CallableNode *func, std::initializer_list<Node *> values) {
+	std::vector<Node *> args;
+	for (auto i: values) {
+		args.push_back(Quoted(i));
+	}
+	return func->Call(state, args);
+}
+
+// calls func with a and b. lambdas take one parameter, so a lambda is
+// called with a and the callable it returns with b.
+Node *ApplyPair(Node::State *state, const std::string& name, CallableNode *func, Node *a, Node *b) {
+	if (dynamic_cast<LambdaFunc::Instance *>(func) == nullptr) {
+		return Apply(state, func, {a, b});
+	}
+	Node *n = Apply(state, func, {a});
+	auto curried = dynamic_cast<CallableNode *>(n);
+	if (curried == nullptr) {
+		if (dynamic_cast<ErrorNode *>(n) != nullptr) {
+			return n;
+		}
+		return new ErrorNode(name + ": a lambda taking two arguments must return a lambda, not '" + n->PPrint() + "'");
+	}
+	return Apply(state, curried, {b});
+}
+
+} // namespace
+
 std::string DefineFunc::PPrint() const {
 	return "{def}";
 }
 
-Node *DefineFunc::Call(std::vector<Node *>& params) {
+Node *DefineFunc::Call(Node::State *state, std::vector<Node *>& params) {
 	// add an entry to the symbol table.
 	if (params.size() == 2) {
 		auto id = dynamic_cast<IdentNode *>(params[0]);
 		if (id) {
 			std::string str = id->str();
-			state->symbol_table()->Put(str, params[1]);
+			Node *value = params[1];
+			if (CallsCreator(state, value)) {
+				value = Quoted(value->Eval(state));
+				if (dynamic_cast<ErrorNode *>(value) != nullptr) {
+					return value;
+				}
+			}
+			state->symbol_table()->Put(str, value);
 			return params[0];
 		} else {
 			return new ErrorNode(PPrint() + ": first argument must be identifier not '" + params[0]->PPrint() + "'");
@@ -29,7 +181,17 @@ std::string LambdaFunc::Instance::PPrint() const {
 	return "lambda";
 }
 
-Node *LambdaFunc::Instance::Call(std::vector<Node *>& params) {
+std::size_t LambdaFunc::Instance::Hash() const {
+	std::hash<const void *> h;
+	return h(table) ^ (h(exp) * 31) ^ std::hash<std::string>()(name->str());
+}
+
+bool LambdaFunc::Instance::Equal(const Node *other) const {
+	auto l = dynamic_cast<const Instance *>(other);
+	return l != nullptr && l->table == table && l->exp == exp && l->name->str() == name->str();
+}
+
+Node *LambdaFunc::Instance::Call(Node::State *state, std::vector<Node *>& params) {
 	// Define these parameters against the ids in the
 	// call to Lambda's 1st parameter (the function definition list).
 	// this is done by looping over the two vectors simultaneosly.
@@ -41,14 +203,31 @@ Node *LambdaFunc::Instance::Call(std::vector<Node *>& params) {
 		return new ErrorNode("lambdas accept one parameter");
 	}
 
-	symb->Put(name->str(), params[0]); // add definition to local symbol table
+	// the argument is evaluated in the caller's scope, where its names
+	// mean what the caller meant, not in the new one, where the
+	// parameter could shadow them.
+	symb->Put(name->str(), Quoted(params[0]->Eval(state)));
 
 	// execute func_body with new symbol table.
 	Node::State s(symb);
+	if (Profiler::enabled()) {
+		// also seen when called by builtins such as pmap and memo.
+		Profiler::Frame frame(Label());
+		return exp->Eval(&s);
+	}
 	return exp->Eval(&s);
 }
 
-Node *LambdaFunc::Call(std::vector<Node *>& params) {
+std::string LambdaFunc::Instance::Label() const {
+	std::ostringstream os;
+	Printer p(&os);
+	p.set_max_depth(2);
+	p.set_max_length(4);
+	p.Print(exp);
+	return "lambda " + name->str() + " " + os.str();
+}
+
+Node *LambdaFunc::Call(Node::State *state, std::vector<Node *>& params) {
 	// this callable takes arguments to create a lambda,
 	// then returns another callable that executes the lambda.
 	if (params.size() == 2) {
@@ -62,7 +241,7 @@ Node *LambdaFunc::Call(std::vector<Node *>& params) {
 	}
 }
 
-Node *NotFunc::Call(std::vector<Node *>& params) {
+Node *NotFunc::Call(Node::State *state, std::vector<Node *>& params) {
 	if (params.size() == 1) {
 		return (!(params[0]->Eval(state))->isTrue()) ? new BooleanNode(true) : new BooleanNode(false);
 	} else {
@@ -70,7 +249,7 @@ Node *NotFunc::Call(std::vector<Node *>& params) {
 	}
 }
 
-Node *QuoteFunc::Call(std::vector<Node *>& params) {
+Node *QuoteFunc::Call(Node::State *state, std::vector<Node *>& params) {
 	if (params.size() != 1) {
 		return new ErrorNode(PPrint() + " takes one atom");
 	} else {
@@ -79,4 +258,883 @@ Node *QuoteFunc::Call(std::vector<Node *>& params) {
 	}
 }
 
+Node *AddFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	std::vector<int> nums;
+	if (Node *err = EvalNums(state, PPrint(), params, &nums)) {
+		return err;
+	}
+	int sum = 0;
+	for (auto i: nums) {
+		sum += i;
+	}
+	return new NumNode(sum);
+}
+
+Node *SubFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.empty()) {
+		return new ErrorNode(PPrint() + " takes at least one atom");
+	}
+	std::vector<int> nums;
+	if (Node *err = EvalNums(state, PPrint(), params, &nums)) {
+		return err;
+	}
+	if (nums.size() == 1) {
+		return new NumNode(-nums[0]);
+	}
+	int diff = nums[0];
+	for (auto i = nums.begin() + 1; i != nums.end(); i++) {
+		diff -= *i;
+	}
+	return new NumNode(diff);
+}
+
+Node *MulFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	std::vector<int> nums;
+	if (Node *err = EvalNums(state, PPrint(), params, &nums)) {
+		return err;
+	}
+	int product = 1;
+	for (auto i: nums) {
+		product *= i;
+	}
+	return new NumNode(product);
+}
+
+MemoFunc::Instance::Instance(CallableNode *f, std::size_t capacity) : func(f), heap(Heap::Current()), cache(capacity) {}
+
+std::size_t MemoFunc::Instance::ArgsHash::operator()(const std::vector<Node *>& args) const {
+	std::size_t h = args.size();
+	for (auto i: args) {
+		h ^= i->Hash() + 0x9e3779b9 + (h << 6) + (h >> 2);
+	}
+	return h;
+}
+
+bool MemoFunc::Instance::ArgsEqual::operator()(const std::vector<Node *>& a, const std::vector<Node *>& b) const {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < a.size(); i++) {
+		if (!a[i]->Equal(b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::string MemoFunc::Instance::PPrint() const {
+	std::lock_guard<std::mutex> lock(mut);
+	return std::string("{memo ") + func->PPrint() + " hits=" + std::to_string(cache.hits()) + " misses=" + std::to_string(cache.misses()) + "}";
+}
+
+Node *MemoFunc::Instance::Call(Node::State *state, std::vector<Node *>& params) {
+	// the cache is keyed by argument values,
+	// so arguments are evaluated before lookup.
+	std::vector<Node *> args;
+	for (auto i: params) {
+		args.push_back(i->Eval(state));
+	}
+	// calls from another isolate are not cached, their arguments
+	// and results are freed with its heap.
+	bool cached = Heap::Current() == heap;
+
+	Node *result;
+	if (cached) {
+		std::lock_guard<std::mutex> lock(mut);
+		if (cache.Get(args, &result)) {
+			return result;
+		}
+	}
+	std::vector<Node *> quoted;
+	for (auto i: args) {
+		quoted.push_back(Quoted(i));
+	}
+	result = func->Call(state, quoted);
+	if (cached && dynamic_cast<ErrorNode *>(result) == nullptr) {
+		// errors may depend on definitions made later, do not cache them.
+		std::lock_guard<std::mutex> lock(mut);
+		cache.Put(args, result);
+	}
+	return result;
+}
+
+Node *MemoFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1 && params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes one or two atoms");
+	}
+
+	// atoms are evaluated before locking, they may call memo themselves.
+	Node *f = params[0]->Eval(state);
+	if (dynamic_cast<CallableNode *>(f) == nullptr) {
+		return new ErrorNode(PPrint() + ": first atom must be Callable not '" + f->PPrint() + "'");
+	}
+
+	std::size_t capacity = kDefaultCapacity;
+	if (params.size() == 2) {
+		auto n = dynamic_cast<NumNode *>(params[1]->Eval(state));
+		if (n == nullptr || n->num() < 0) {
+			return new ErrorNode(PPrint() + ": capacity must be a non-negative number not '" + params[1]->PPrint() + "'");
+		}
+		capacity = n->num();
+	}
+
+	Key key{static_cast<CallableNode *>(f), capacity};
+	std::lock_guard<std::mutex> lock(mut);
+	auto i = instances.find(key);
+	if (i != instances.end()) {
+		return i->second;
+	}
+	auto instance = new Instance(key.func, capacity);
+	instances[key] = instance;
+	return instance;
+}
+
+Node *PMapFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	CallableNode *func;
+	std::vector<Node *> items;
+	if (Node *err = EvalCallAndList(state, PPrint(), params[0], params[1], &func, &items)) {
+		return err;
+	}
+	if (items.empty()) {
+		return new NullNode();
+	}
+
+	std::vector<Node *> results(items.size());
+	Meter::Shared fuel = Meter::Share();
+	ScopeObserver *observer = ScopeObserver::Current();
+	WorkerPool::Default()->ParallelFor(items.size(), kParallelGrain, [&](std::size_t begin, std::size_t end) {
+		Meter::Use metered(fuel);
+		ScopeObserver::Use observe(observer);
+		for (std::size_t i = begin; i < end; i++) {
+			results[i] = Apply(state, func, {items[i]});
+		}
+	});
+
+	auto list = new ListNode();
+	for (auto i: results) {
+		list->Put(i);
+	}
+	return list;
+}
+
+Node *PForFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	CallableNode *func;
+	std::vector<Node *> items;
+	if (Node *err = EvalCallAndList(state, PPrint(), params[0], params[1], &func, &items)) {
+		return err;
+	}
+	Meter::Shared fuel = Meter::Share();
+	ScopeObserver *observer = ScopeObserver::Current();
+	WorkerPool::Default()->ParallelFor(items.size(), kParallelGrain, [&](std::size_t begin, std::size_t end) {
+		Meter::Use metered(fuel);
+		ScopeObserver::Use observe(observer);
+		for (std::size_t i = begin; i < end; i++) {
+			Apply(state, func, {items[i]});
+		}
+	});
+	return new NullNode();
+}
+
+Node *PReduceFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 3) {
+		return new ErrorNode(PPrint() + " takes three atoms");
+	}
+	CallableNode *func;
+	std::vector<Node *> items;
+	if (Node *err = EvalCallAndList(state, PPrint(), params[0], params[2], &func, &items)) {
+		return err;
+	}
+	Node *acc = params[1]->Eval(state);
+	if (items.empty()) {
+		return acc;
+	}
+
+	// each chunk is folded from its first item, then the partial
+	// results are folded in order, so func must be associative.
+	std::mutex mut;
+	std::map<std::size_t, Node *> partials;
+	Meter::Shared fuel = Meter::Share();
+	ScopeObserver *observer = ScopeObserver::Current();
+	WorkerPool::Default()->ParallelFor(items.size(), kParallelGrain, [&](std::size_t begin, std::size_t end) {
+		Meter::Use metered(fuel);
+		ScopeObserver::Use observe(observer);
+		Node *part = items[begin];
+		for (std::size_t i = begin + 1; i < end; i++) {
+			part = ApplyPair(state, PPrint(), func, part, items[i]);
+		}
+		std::lock_guard<std::mutex> lock(mut);
+		partials[begin] = part;
+	});
+	for (auto i: partials) {
+		acc = ApplyPair(state, PPrint(), func, acc, i.second);
+	}
+	return acc;
+}
+
+Node *FutureFunc::Instance::Eval(State *state) const {
+	return const_cast<Instance *>(this); // futures evaluate to themselves
+}
+
+std::string FutureFunc::Instance::PPrint() const {
+	return done_ ? value_->PPrint() : "{future}";
+}
+
+Node *FutureFunc::Instance::Touch() {
+	WorkerPool::Default()->HelpUntil([this]() { return done_.load(); });
+	return value_;
+}
+
+void FutureFunc::Instance::Resolve(Node *value) {
+	value_ = value;
+	done_ = true;
+}
+
+Node *FutureFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	auto future = new Instance();
+	Node *exp = params[0];
+	// the calling state may not outlive the call.
+	Node::State *s = new Node::State(state->symbol_table());
+	std::shared_ptr<Output> out = Output::Current()->shared_from_this();
+	Meter::Shared fuel = Meter::Share();
+	ScopeObserver *o = ScopeObserver::Current();
+	std::shared_ptr<ScopeObserver> observer = o != nullptr ? o->shared_from_this() : nullptr;
+	WorkerPool::Default()->Submit([future, exp, s, out, fuel, observer]() {
+		Output::Use use(out.get());
+		Meter::Use metered(fuel);
+		ScopeObserver::Use observe(observer.get());
+		future->Resolve(exp->Eval(s));
+	});
+	return future;
+}
+
+Node *TouchFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	auto future = dynamic_cast<FutureFunc::Instance *>(n);
+	if (future == nullptr) {
+		// touching a value that is not a future yields the value.
+		return n;
+	}
+	return future->Touch();
+}
+
+Node *SpawnFunc::Instance::Eval(State *state) const {
+	return const_cast<Instance *>(this); // fibers evaluate to themselves
+}
+
+std::string SpawnFunc::Instance::PPrint() const {
+	Fiber *f = fiber;
+	return f != nullptr && f->done() ? "{fiber done}" : "{fiber}";
+}
+
+Node *SpawnFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	auto instance = new Instance();
+	Node *exp = params[0];
+	// the calling state may not outlive the call.
+	Node::State *s = new Node::State(state->symbol_table());
+	Meter::Shared fuel = Meter::Share();
+	instance->fiber = Fiber::Spawn(WorkerPool::Default(), [exp, s, fuel]() {
+		Meter::Use metered(fuel);
+		exp->Eval(s);
+	});
+	return instance;
+}
+
+Node *MakeChanFunc::Instance::Eval(State *state) const {
+	return const_cast<Instance *>(this); // channels evaluate to themselves
+}
+
+Node *MakeChanFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() > 1) {
+		return new ErrorNode(PPrint() + " takes zero or one atoms");
+	}
+	std::size_t capacity = 0;
+	if (params.size() == 1) {
+		auto n = dynamic_cast<NumNode *>(params[0]->Eval(state));
+		if (n == nullptr || n->num() < 0) {
+			return new ErrorNode(PPrint() + ": capacity must be a non-negative number not '" + params[0]->PPrint() + "'");
+		}
+		capacity = n->num();
+	}
+	return new Instance(capacity);
+}
+
+namespace {
+
+// evaluates node as a channel, returning nullptr if it is not one.
+MakeChanFunc::Instance *EvalChan(Node::State *state, Node *node) {
+	return dynamic_cast<MakeChanFunc::Instance *>(node->Eval(state));
+}
+
+} // namespace
+
+Node *SendFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	auto c = EvalChan(state, params[0]);
+	if (c == nullptr) {
+		return new ErrorNode(PPrint() + ": first atom must be a channel not '" + params[0]->PPrint() + "'");
+	}
+	Node *value = params[1]->Eval(state);
+	c->chan.Put(value);
+	return value;
+}
+
+Node *RecvFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	auto c = EvalChan(state, params[0]);
+	if (c == nullptr) {
+		return new ErrorNode(PPrint() + ": atom must be a channel not '" + params[0]->PPrint() + "'");
+	}
+	return c->chan.Get();
+}
+
+Node *SelectFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.empty()) {
+		return new ErrorNode(PPrint() + " takes at least one atom");
+	}
+	std::vector<FiberChannel<Node *> *> chans;
+	for (auto i: params) {
+		auto c = EvalChan(state, i);
+		if (c == nullptr) {
+			return new ErrorNode(PPrint() + ": atoms must be channels not '" + i->PPrint() + "'");
+		}
+		chans.push_back(&c->chan);
+	}
+	Node *value;
+	int index = FiberChannel<Node *>::Select(chans, &value);
+	auto list = new ListNode();
+	list->Put(new NumNode(index));
+	list->Put(value);
+	return list;
+}
+
+Node *HashMapFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() % 2 != 0) {
+		return new ErrorNode(PPrint() + " takes keys and values in pairs");
+	}
+	Hamt::Transient map((Hamt()));
+	for (std::size_t i = 0; i < params.size(); i += 2) {
+		map.Assoc(params[i]->Eval(state), params[i + 1]->Eval(state));
+	}
+	return new MapNode(map.Persistent());
+}
+
+Node *HashSetFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	Hamt::Transient set((Hamt()));
+	for (auto i: params) {
+		Node *n = i->Eval(state);
+		set.Assoc(n, n);
+	}
+	return new SetNode(set.Persistent());
+}
+
+Node *AssocFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.empty()) {
+		return new ErrorNode(PPrint() + " takes at least one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	if (auto m = dynamic_cast<MapNode *>(n)) {
+		if (params.size() % 2 != 1) {
+			return new ErrorNode(PPrint() + " takes keys and values in pairs");
+		}
+		// the new bindings are made in place on the copied path.
+		Hamt::Transient map(m->map());
+		for (std::size_t i = 1; i < params.size(); i += 2) {
+			map.Assoc(params[i]->Eval(state), params[i + 1]->Eval(state));
+		}
+		return new MapNode(map.Persistent());
+	} else if (auto s = dynamic_cast<SetNode *>(n)) {
+		Hamt::Transient set(s->set());
+		for (std::size_t i = 1; i < params.size(); i++) {
+			Node *k = params[i]->Eval(state);
+			set.Assoc(k, k);
+		}
+		return new SetNode(set.Persistent());
+	}
+	return new ErrorNode(PPrint() + ": first atom must be a Map or Set not '" + n->PPrint() + "'");
+}
+
+Node *DissocFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.empty()) {
+		return new ErrorNode(PPrint() + " takes at least one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	auto m = dynamic_cast<MapNode *>(n);
+	auto s = dynamic_cast<SetNode *>(n);
+	if (m == nullptr && s == nullptr) {
+		return new ErrorNode(PPrint() + ": first atom must be a Map or Set not '" + n->PPrint() + "'");
+	}
+	Hamt::Transient t(m != nullptr ? m->map() : s->set());
+	for (std::size_t i = 1; i < params.size(); i++) {
+		t.Dissoc(params[i]->Eval(state));
+	}
+	if (m != nullptr) {
+		return new MapNode(t.Persistent());
+	}
+	return new SetNode(t.Persistent());
+}
+
+Node *GetFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2 && params.size() != 3) {
+		return new ErrorNode(PPrint() + " takes two or three atoms");
+	}
+	Node *n = params[0]->Eval(state);
+	const Hamt *h = nullptr;
+	if (auto m = dynamic_cast<MapNode *>(n)) {
+		h = &m->map();
+	} else if (auto s = dynamic_cast<SetNode *>(n)) {
+		h = &s->set();
+	} else {
+		return new ErrorNode(PPrint() + ": first atom must be a Map or Set not '" + n->PPrint() + "'");
+	}
+	Node *v = h->Get(params[1]->Eval(state));
+	if (v != nullptr) {
+		return v;
+	}
+	return params.size() == 3 ? params[2]->Eval(state) : new NullNode();
+}
+
+Node *ContainsFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	Node *n = params[0]->Eval(state);
+	const Hamt *h = nullptr;
+	if (auto m = dynamic_cast<MapNode *>(n)) {
+		h = &m->map();
+	} else if (auto s = dynamic_cast<SetNode *>(n)) {
+		h = &s->set();
+	} else {
+		return new ErrorNode(PPrint() + ": first atom must be a Map or Set not '" + n->PPrint() + "'");
+	}
+	return new BooleanNode(h->Get(params[1]->Eval(state)) != nullptr);
+}
+
+std::string MapListFunc::PPrint() const {
+	switch (part) {
+	case kKeys:
+		return "{keys}";
+	case kValues:
+		return "{vals}";
+	default:
+		return "{entries}";
+	}
+}
+
+Node *MapListFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	const Hamt *h = nullptr;
+	if (auto m = dynamic_cast<MapNode *>(n)) {
+		h = &m->map();
+	} else if (auto s = dynamic_cast<SetNode *>(n)) {
+		h = &s->set();
+	} else {
+		return new ErrorNode(PPrint() + ": atom must be a Map or Set not '" + n->PPrint() + "'");
+	}
+	if (h->size() == 0) {
+		return new NullNode();
+	}
+	auto list = new ListNode();
+	h->ForEach([&](Node *k, Node *v) {
+		if (part == kKeys) {
+			list->Put(k);
+		} else if (part == kValues) {
+			list->Put(v);
+		} else {
+			auto entry = new ListNode();
+			entry->Put(k);
+			entry->Put(v);
+			list->Put(entry);
+		}
+	});
+	return list;
+}
+
+Node *ListFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	std::vector<Node *> items;
+	for (auto i: params) {
+		items.push_back(i->Eval(state));
+	}
+	return ListValue(VList::FromVector(items));
+}
+
+Node *CarFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	if (auto l = dynamic_cast<ListNode *>(n)) {
+		// the head of a syntax list needs no copy.
+		if (!l->children().empty()) {
+			return l->children().front();
+		}
+	} else if (auto v = dynamic_cast<VListNode *>(n)) {
+		return v->list().First();
+	} else if (auto seq = dynamic_cast<SeqNode *>(n)) {
+		// only the first element is produced.
+		Node *first = nullptr;
+		if (Node *err = seq->ForEach(state, [&first](Node *i) {
+			first = i;
+			return false;
+		})) {
+			return err;
+		}
+		if (first != nullptr) {
+			return first;
+		}
+	}
+	return new ErrorNode(PPrint() + ": expected a non-empty List not '" + n->PPrint() + "'");
+}
+
+Node *CdrFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	if (auto seq = dynamic_cast<SeqNode *>(n)) {
+		// the rest of a sequence stays lazy.
+		return seq->With(SeqNode::Stage{SeqNode::Stage::kDrop, nullptr, 1});
+	}
+	VList list;
+	if (Node *err = EvalList(state, PPrint(), Quoted(n), &list)) {
+		return err;
+	}
+	if (list.empty()) {
+		return new ErrorNode(PPrint() + ": expected a non-empty List");
+	}
+	return ListValue(list.Rest());
+}
+
+Node *ConsFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	Node *item = params[0]->Eval(state);
+	VList list;
+	if (Node *err = EvalList(state, PPrint(), params[1], &list)) {
+		return err;
+	}
+	return ListValue(list.Cons(item));
+}
+
+Node *AppendFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	std::vector<VList> lists(params.size());
+	for (std::size_t i = 0; i < params.size(); i++) {
+		if (Node *err = EvalList(state, PPrint(), params[i], &lists[i])) {
+			return err;
+		}
+	}
+	// joined from the back, the last list is shared rather than copied.
+	VList list;
+	for (auto i = lists.rbegin(); i != lists.rend(); i++) {
+		list = i->Append(list);
+	}
+	return ListValue(list);
+}
+
+Node *LengthFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	if (auto l = dynamic_cast<ListNode *>(n)) {
+		return new NumNode(l->children().size());
+	} else if (auto v = dynamic_cast<VListNode *>(n)) {
+		return new NumNode(v->list().size());
+	} else if (auto s = dynamic_cast<StringNode *>(n)) {
+		StringPiece str = s->str().piece();
+		return new NumNode(utf8::Count(str.data(), str.size()));
+	} else if (auto seq = dynamic_cast<SeqNode *>(n)) {
+		long count = 0;
+		if (Node *err = seq->ForEach(state, [&count](Node *) {
+			count++;
+			return true;
+		})) {
+			return err;
+		}
+		return new NumNode(count);
+	} else if (dynamic_cast<NullNode *>(n) != nullptr) {
+		return new NumNode(0);
+	}
+	return new ErrorNode(PPrint() + ": expected a List or String not '" + n->PPrint() + "'");
+}
+
+Node *ConcatFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	std::vector<SharedString> strs;
+	if (Node *err = EvalStrings(state, PPrint(), params, &strs)) {
+		return err;
+	}
+	SharedString s;
+	for (auto& i: strs) {
+		s = SharedString::Concat(s, i);
+	}
+	return new StringNode(s);
+}
+
+Node *SubstringFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2 && params.size() != 3) {
+		return new ErrorNode(PPrint() + " takes two or three atoms");
+	}
+	Node *n = params[0]->Eval(state);
+	auto s = dynamic_cast<StringNode *>(n);
+	if (s == nullptr) {
+		return new ErrorNode(PPrint() + ": first atom must be a String not '" + n->PPrint() + "'");
+	}
+	std::vector<Node *> bounds(params.begin() + 1, params.end());
+	std::vector<int> nums;
+	if (Node *err = EvalNums(state, PPrint(), bounds, &nums)) {
+		return err;
+	}
+	// indexes count characters, not bytes.
+	StringPiece str = s->str().piece();
+	int size = utf8::Count(str.data(), str.size());
+	int start = nums[0], len = nums.size() == 2 ? nums[1] : size - start;
+	if (start < 0 || start > size || len < 0 || len > size - start) {
+		return new ErrorNode(PPrint() + ": range out of bounds of '" + s->PPrint() + "'");
+	}
+	std::size_t first = utf8::Offset(str.data(), str.size(), start);
+	std::size_t last = first + utf8::Offset(str.data() + first, str.size() - first, len);
+	return new StringNode(s->str().Substr(first, last - first));
+}
+
+Node *CompareFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	std::vector<SharedString> strs;
+	if (Node *err = EvalStrings(state, PPrint(), params, &strs)) {
+		return err;
+	}
+	int c = strs[0].compare(strs[1]);
+	return new NumNode(c < 0 ? -1 : (c > 0 ? 1 : 0));
+}
+
+Node *DefmacroFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 3) {
+		return new ErrorNode(PPrint() + " takes three atoms");
+	}
+	auto id = dynamic_cast<IdentNode *>(params[0]);
+	if (id == nullptr) {
+		return new ErrorNode(PPrint() + ": first atom must be identifier not '" + params[0]->PPrint() + "'");
+	}
+	std::vector<std::string> names;
+	if (auto p = dynamic_cast<IdentNode *>(params[1])) {
+		names.push_back(p->str());
+	} else if (auto l = dynamic_cast<ListNode *>(params[1])) {
+		for (auto i: l->children()) {
+			auto p = dynamic_cast<IdentNode *>(i);
+			if (p == nullptr) {
+				return new ErrorNode(PPrint() + ": parameters must be identifiers not '" + i->PPrint() + "'");
+			}
+			names.push_back(p->str());
+		}
+	} else {
+		return new ErrorNode(PPrint() + ": second atom must be identifier or List not '" + params[1]->PPrint() + "'");
+	}
+	state->symbol_table()->Put(id->str(), new MacroNode(id->str(), names, params[2], state->symbol_table()));
+	return params[0];
+}
+
+Node *GensymFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (!params.empty()) {
+		return new ErrorNode(PPrint() + " takes no atoms");
+	}
+	// identifiers starting with # are not written by users.
+	return new IdentNode("#g" + std::to_string(++next));
+}
+
+Node *RequireFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1 && params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes one or two atoms");
+	}
+	for (auto i: params) {
+		if (dynamic_cast<IdentNode *>(i) == nullptr) {
+			return new ErrorNode(PPrint() + ": atoms must be identifiers not '" + i->PPrint() + "'");
+		}
+	}
+	auto name = static_cast<IdentNode *>(params.back());
+	ModuleNode *module = ModuleLoader::Default()->Resolve(name->str());
+	if (module == nullptr) {
+		return new ErrorNode(PPrint() + ": module '" + name->str() + "' not found");
+	}
+	state->symbol_table()->Put(static_cast<IdentNode *>(params[0])->str(), module);
+	return module;
+}
+
+Node *DelayFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	// the calling state may not outlive the call.
+	return new PromiseNode(params[0], new Node::State(state->symbol_table()));
+}
+
+Node *ForceFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 1) {
+		return new ErrorNode(PPrint() + " takes one atom");
+	}
+	Node *n = params[0]->Eval(state);
+	if (auto promise = dynamic_cast<PromiseNode *>(n)) {
+		return promise->Force();
+	} else if (auto seq = dynamic_cast<SeqNode *>(n)) {
+		std::vector<Node *> items;
+		if (Node *err = Realize(state, seq, &items)) {
+			return err;
+		}
+		return ListValue(VList::FromVector(items));
+	}
+	// forcing a value that is not lazy yields the value.
+	return n;
+}
+
+Node *RangeFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() > 3) {
+		return new ErrorNode(PPrint() + " takes zero to three atoms");
+	}
+	std::vector<int> nums;
+	if (Node *err = EvalNums(state, PPrint(), params, &nums)) {
+		return err;
+	}
+	switch (nums.size()) {
+	case 0:
+		return SeqNode::Range(0, 0, 1, false);
+	case 1:
+		return SeqNode::Range(0, nums[0], 1, true);
+	case 2:
+		return SeqNode::Range(nums[0], nums[1], 1, true);
+	}
+	if (nums[2] == 0) {
+		return new ErrorNode(PPrint() + ": step must not be zero");
+	}
+	return SeqNode::Range(nums[0], nums[1], nums[2], true);
+}
+
+std::string SeqStageFunc::PPrint() const {
+	switch (kind) {
+	case SeqNode::Stage::kMap:
+		return "{lazy-map}";
+	case SeqNode::Stage::kFilter:
+		return "{lazy-filter}";
+	case SeqNode::Stage::kTake:
+		return "{take}";
+	case SeqNode::Stage::kDrop:
+		return "{drop}";
+	}
+	return "{seq}";
+}
+
+Node *SeqStageFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	if (params.size() != 2) {
+		return new ErrorNode(PPrint() + " takes two atoms");
+	}
+	SeqNode::Stage stage{kind, nullptr, 0};
+	Node *n = params[0]->Eval(state);
+	if (kind == SeqNode::Stage::kMap || kind == SeqNode::Stage::kFilter) {
+		stage.func = dynamic_cast<CallableNode *>(n);
+		if (stage.func == nullptr) {
+			return new ErrorNode(PPrint() + ": first atom must be Callable not '" + n->PPrint() + "'");
+		}
+	} else {
+		auto num = dynamic_cast<NumNode *>(n);
+		if (num == nullptr || num->num() < 0) {
+			return new ErrorNode(PPrint() + ": count must be a non-negative number not '" + n->PPrint() + "'");
+		}
+		stage.n = num->num();
+	}
+
+	// sequences gain a stage, lists become the source of one.
+	Node *source = params[1]->Eval(state);
+	if (auto seq = dynamic_cast<SeqNode *>(source)) {
+		return seq->With(stage);
+	}
+	VList list;
+	if (Node *err = EvalList(state, PPrint(), Quoted(source), &list)) {
+		return err;
+	}
+	return SeqNode::Of(list)->With(stage);
+}
+
+namespace {
+
+// returns the contents of the file named by the atom in params,
+// or an ErrorNode.
+Node *MapFile(Node::State *state, const std::string& name, std::vector<Node *>& params, SharedString *contents) {
+	if (params.size() != 1) {
+		return new ErrorNode(name + " takes one atom");
+	}
+	std::vector<SharedString> path;
+	if (Node *err = EvalStrings(state, name, params, &path)) {
+		return err;
+	}
+	std::shared_ptr<MappedFile> file(MappedFile::Open(path[0].ToString()));
+	if (file == nullptr) {
+		return new ErrorNode(name + ": cannot read '" + path[0].ToString() + "'");
+	}
+	*contents = SharedString::View(file->contents(), file);
+	return nullptr;
+}
+
+} // namespace
+
+Node *ReadFileFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	SharedString contents;
+	if (Node *err = MapFile(state, PPrint(), params, &contents)) {
+		return err;
+	}
+	return new StringNode(contents);
+}
+
+Node *LinesFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	SharedString contents;
+	if (Node *err = MapFile(state, PPrint(), params, &contents)) {
+		return err;
+	}
+	return SeqNode::Lines(contents);
+}
+
+Node *WriteFunc::Call(Node::State *state, std::vector<Node *>& params) {
+	Output *out = Output::Current();
+	int n = 0;
+	for (auto i: params) {
+		Node *v = i->Eval(state);
+		if (dynamic_cast<ErrorNode *>(v) != nullptr) {
+			return v;
+		}
+		bool ok;
+		if (auto s = dynamic_cast<StringNode *>(v)) {
+			ok = out->Write(s->str().piece());
+			n += s->str().size();
+		} else {
+			std::string p = v->PPrint();
+			ok = out->Write(p);
+			n += p.size();
+		}
+		if (!ok) {
+			return new ErrorNode(PPrint() + ": " + out->error());
+		}
+	}
+	return new NumNode(n);
+}
+
 } // namespace crisp
@@ -3,55 +3,502 @@
 #define CRISP_FUNCTIONS_H_
 
 #include "tree.h"
+#include "cache.h"
+#include "channel.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_map>
 
 namespace crisp {
 
+class Heap;
+
+// builtin callable. builtins hold no state of their own and
+// evaluate their atoms in the state they are called from,
+// so one instance is shared by every state.
 class CallNode : public CallableNode {
 public:
-	CallNode(Node::State *s) : state(s) {}
-protected:
-	Node::State *state;
+	// returns true if calls depend only on the values
+	// of their arguments and have no side effects.
+	virtual bool Pure() const { return false; }
+	// returns true if each call makes a new runtime object, such as
+	// a channel, so that a definition binds the value of a call once
+	// rather than the call, which would make one per reference.
+	virtual bool Creates() const { return false; }
 };
 
-// callable node that adds symbols to a symbol table.
+// callable node that adds symbols to a symbol table. the value is
+// bound unevaluated, unless it is a call to a builtin that creates
+// a runtime object, whose value is bound instead.
 class DefineFunc : public CallNode {
 public:
-	DefineFunc(Node::State *s) : CallNode(s) {}
 	virtual std::string PPrint() const;
-	virtual Node *Call(std::vector<Node *>& params);
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
 };
 
+// callable node that makes a lambda of one parameter, which closes
+// over the scope it is made in. its argument is evaluated once, in
+// the caller's scope, and the parameter is bound to the value.
 class LambdaFunc : public CallNode {
 public:
-	LambdaFunc(Node::State *s) : CallNode(s) {}
 
 	class Instance : public CallableNode {
 	public:
 		Instance(Node::State::SymbolTableInterface *t, IdentNode *n, Node *expression);
 		virtual std::string PPrint() const;
-		virtual Node *Call(std::vector<Node *>& params);
+		virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+		// instances made by the same lambda form in the same
+		// scope behave the same, so they are equal.
+		virtual std::size_t Hash() const;
+		virtual bool Equal(const Node *other) const;
+		IdentNode *param() const { return name; }
+		Node *body() const { return exp; }
 	private:
+		// names the instance's profiler frames by its parameter and
+		// the start of its body, so anonymous lambdas are told apart.
+		std::string Label() const;
+
 		Node::State::SymbolTableInterface *table;
 		IdentNode *name;
 		Node *exp;
 	};
 
 	virtual std::string PPrint() const { return "{lambda}"; }
-	virtual Node *Call(std::vector<Node *>& params);
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
 };
 
 class NotFunc : public CallNode {
 public:
-	NotFunc(Node::State *s) : CallNode(s) {}
 	virtual std::string PPrint() const { return "{not}"; }
-	virtual Node *Call(std::vector<Node *>& params);
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
 };
 
 class QuoteFunc : public CallNode {
 public:
-	QuoteFunc(Node::State *s) : CallNode(s) {}
 	virtual std::string PPrint() const { return "{quote}"; }
-	virtual Node *Call(std::vector<Node *>& params);
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that sums its numeric arguments.
+class AddFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{+}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that subtracts its trailing numeric arguments
+// from the first, or negates a single argument.
+class SubFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{-}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that multiplies its numeric arguments.
+class MulFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{*}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that wraps a callable in a cache of its results
+// keyed by the structure of its evaluated arguments.
+class MemoFunc : public CallNode {
+public:
+
+	// default number of results cached per memoized callable.
+	static const std::size_t kDefaultCapacity = 1024;
+
+	class Instance : public CallableNode {
+	public:
+		Instance(CallableNode *f, std::size_t capacity);
+		virtual std::string PPrint() const;
+		virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+	private:
+		struct ArgsHash {
+			std::size_t operator()(const std::vector<Node *>& args) const;
+		};
+		struct ArgsEqual {
+			bool operator()(const std::vector<Node *>& a, const std::vector<Node *>& b) const;
+		};
+
+		CallableNode *func;
+		// the heap the instance was made in, only calls
+		// from the same heap are cached.
+		Heap *heap;
+		mutable std::mutex mut;
+		LruCache<std::vector<Node *>, Node *, ArgsHash, ArgsEqual> cache;
+	};
+
+	virtual std::string PPrint() const { return "{memo}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+private:
+	struct Key {
+		CallableNode *func;
+		std::size_t capacity;
+	};
+	struct KeyHash {
+		std::size_t operator()(const Key& k) const { return k.func->Hash() ^ k.capacity; }
+	};
+	struct KeyEqual {
+		bool operator()(const Key& a, const Key& b) const { return a.capacity == b.capacity && a.func->Equal(b.func); }
+	};
+
+	// instances by the callable and capacity they wrap,
+	// so re-evaluating a definition reuses its cache.
+	std::mutex mut;
+	std::unordered_map<Key, Instance *, KeyHash, KeyEqual> instances;
+};
+
+// callable node that maps a callable over a list in parallel,
+// returning the list of results.
+class PMapFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{pmap}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that calls a callable on each item of a list
+// in parallel for its side effects.
+class PForFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{pfor}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that folds a list with an associative
+// two argument callable, reducing chunks in parallel.
+// a lambda reducer is curried, (lambda a (lambda b ...)).
+class PReduceFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{preduce}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that starts evaluating its atom in the
+// background, returning a future to touch for the result.
+class FutureFunc : public CallNode {
+public:
+
+	class Instance : public Node {
+	public:
+		Instance() : done_(false) {}
+		virtual Node *Eval(State *state) const;
+		virtual std::string PPrint() const;
+
+		// returns the result, helping run queued work until it is ready.
+		Node *Touch();
+		void Resolve(Node *value);
+	private:
+		std::atomic<bool> done_;
+		Node *value_ = nullptr;
+	};
+
+	virtual std::string PPrint() const { return "{future}"; }
+	virtual bool Creates() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that waits for a future's result.
+class TouchFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{touch}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that evaluates its atom on a new fiber.
+class SpawnFunc : public CallNode {
+public:
+
+	class Instance : public Node {
+	public:
+		Instance() : fiber(nullptr) {}
+		virtual Node *Eval(State *state) const;
+		virtual std::string PPrint() const;
+		std::atomic<Fiber *> fiber;
+	};
+
+	virtual std::string PPrint() const { return "{spawn}"; }
+	virtual bool Creates() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that creates a channel,
+// unbuffered unless given a capacity.
+class MakeChanFunc : public CallNode {
+public:
+
+	class Instance : public Node {
+	public:
+		Instance(std::size_t capacity) : chan(capacity) {}
+		virtual Node *Eval(State *state) const;
+		virtual std::string PPrint() const { return "{chan}"; }
+		FiberChannel<Node *> chan;
+	};
+
+	virtual std::string PPrint() const { return "{make-chan}"; }
+	virtual bool Creates() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that sends a value on a channel.
+class SendFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{send}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that receives a value from a channel.
+class RecvFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{recv}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that receives from the first ready channel,
+// returning a list of the channel's index and the value.
+class SelectFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{select}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that builds a map from alternating keys and values.
+class HashMapFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{hash-map}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that builds a set of its atoms.
+class HashSetFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{hash-set}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a map with keys bound to values,
+// or a set with members added.
+class AssocFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{assoc}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a map or set without the given keys.
+class DissocFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{dissoc}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that looks up a key in a map or set,
+// yielding its third atom or null if it is missing.
+class GetFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{get}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that tests if a map or set has a key.
+class ContainsFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{contains}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that lists the keys, values or (key value)
+// entries of a map, or the members of a set.
+class MapListFunc : public CallNode {
+public:
+	enum Part { kKeys, kValues, kEntries };
+	MapListFunc(Part p) : part(p) {}
+	virtual std::string PPrint() const;
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+private:
+	Part part;
+};
+
+// callable node that returns a list of its evaluated atoms.
+class ListFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{list}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns the first item of a list.
+class CarFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{car}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a list without its first item.
+class CdrFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{cdr}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a list of an item followed by a list.
+class ConsFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{cons}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that joins lists.
+class AppendFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{append}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns the number of items in a list
+// or characters in a string.
+class LengthFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{length}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that joins strings, long results share their
+// parts rather than copying them.
+class ConcatFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{concat}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns the characters of a string from
+// a start index, to its end or for a given length.
+class SubstringFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{substring}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that orders two strings, returning -1, 0 or 1.
+class CompareFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{compare}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that defines a macro, (defmacro name params body)
+// where params is an identifier or a list of identifiers.
+class DefmacroFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{defmacro}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns an identifier no other code uses,
+// for macros to bind without capturing names at the call site.
+class GensymFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{gensym}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+private:
+	std::atomic<unsigned long> next{0};
+};
+
+// callable node that binds a module to its name, or to an alias
+// with (require alias name). the module's symbols are then named
+// name/symbol, and it is loaded when the first of them is used.
+class RequireFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{require}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that delays evaluating its atom until forced.
+class DelayFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{delay}"; }
+	virtual bool Creates() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns the value of a promise,
+// or the elements of a sequence as a list.
+class ForceFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{force}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a lazy sequence of integers,
+// (range) is infinite, (range end), (range start end)
+// and (range start end step) stop before end.
+class RangeFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{range}"; }
+	virtual bool Pure() const { return true; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that adds a stage to a lazy sequence, or makes
+// a sequence of a list. lazy-map and lazy-filter take a callable
+// and take and drop a count, followed by the sequence.
+class SeqStageFunc : public CallNode {
+public:
+	SeqStageFunc(SeqNode::Stage::Kind k) : kind(k) {}
+	virtual std::string PPrint() const;
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+private:
+	SeqNode::Stage::Kind kind;
+};
+
+// callable node that returns the contents of a file as a string.
+// the file is mapped rather than read, and the string and its
+// substrings share the mapping, so only the pages used are loaded.
+// truncating a mapped file while it is in use raises SIGBUS,
+// small files are copied and are not affected.
+class ReadFileFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{read-file}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that returns a lazy sequence of the lines of a file,
+// without their newlines. (lines path) maps the file like read-file.
+class LinesFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{lines}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
+};
+
+// callable node that writes its atoms to the current output, standard
+// out through a buffer unless serving a request, strings as their
+// characters and other values printed.
+// returns the number of bytes written.
+class WriteFunc : public CallNode {
+public:
+	virtual std::string PPrint() const { return "{write}"; }
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params);
 };
 
 }; // namespace crisp
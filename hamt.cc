@@ -0,0 +1,276 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "hamt.h"
+#include "heap.h"
+#include "tree.h"
+
+#include <atomic>
+#include <vector>
+
+namespace crisp {
+namespace hamt {
+
+struct Entry {
+	Node *key;
+	Node *value;
+	std::size_t hash;
+};
+
+// a trie node. datamap has a bit for each entry stored here and
+// nodemap a bit for each child, both arrays are kept in bit order.
+// nodes below kMaxShift are collision buckets of unordered entries.
+// tries are allocated from the current heap, with the maps using them.
+struct Trie : public HeapObject {
+	uint32_t datamap = 0;
+	uint32_t nodemap = 0;
+	// the transient that may change this node in place, or 0.
+	uint64_t edit = 0;
+	std::vector<Entry> entries;
+	std::vector<Trie *> children;
+};
+
+namespace {
+
+const int kBits = 5;
+const std::size_t kMask = (1 << kBits) - 1;
+// tries deeper than this have run out of hash bits.
+const int kMaxShift = sizeof(std::size_t) * 8;
+
+std::atomic<uint64_t> next_edit = {1};
+
+uint32_t Bit(std::size_t hash, int shift) {
+	return 1u << ((hash >> shift) & kMask);
+}
+
+int Index(uint32_t map, uint32_t bit) {
+	return __builtin_popcount(map & (bit - 1));
+}
+
+bool Same(const Entry& e, const Node *key, std::size_t hash) {
+	return e.hash == hash && (e.key == key || e.key->Equal(key));
+}
+
+// returns t if it may be changed in place, or a copy that may be.
+Trie *Editable(Trie *t, uint64_t edit) {
+	if (edit != 0 && t->edit == edit) {
+		return t;
+	}
+	Trie *c = new Trie(*t);
+	c->edit = edit;
+	return c;
+}
+
+// returns a trie of two entries with different keys.
+Trie *Pair(const Entry& a, const Entry& b, int shift, uint64_t edit) {
+	Trie *t = new Trie();
+	t->edit = edit;
+	if (shift >= kMaxShift) {
+		t->entries = {a, b};
+		return t;
+	}
+	uint32_t ba = Bit(a.hash, shift), bb = Bit(b.hash, shift);
+	if (ba == bb) {
+		t->nodemap = ba;
+		t->children.push_back(Pair(a, b, shift + kBits, edit));
+	} else {
+		t->datamap = ba | bb;
+		t->entries = ba < bb ? std::vector<Entry>{a, b} : std::vector<Entry>{b, a};
+	}
+	return t;
+}
+
+Trie *Assoc(Trie *t, const Entry& e, int shift, uint64_t edit, bool *added) {
+	if (shift >= kMaxShift) {
+		for (std::size_t i = 0; i < t->entries.size(); i++) {
+			if (Same(t->entries[i], e.key, e.hash)) {
+				if (t->entries[i].value == e.value) {
+					return t;
+				}
+				Trie *c = Editable(t, edit);
+				c->entries[i].value = e.value;
+				return c;
+			}
+		}
+		Trie *c = Editable(t, edit);
+		c->entries.push_back(e);
+		*added = true;
+		return c;
+	}
+
+	uint32_t bit = Bit(e.hash, shift);
+	if (t->datamap & bit) {
+		int i = Index(t->datamap, bit);
+		Entry old = t->entries[i];
+		if (Same(old, e.key, e.hash)) {
+			if (old.value == e.value) {
+				return t;
+			}
+			Trie *c = Editable(t, edit);
+			c->entries[i].value = e.value;
+			return c;
+		}
+		// both entries move down into a new child.
+		Trie *c = Editable(t, edit);
+		c->entries.erase(c->entries.begin() + i);
+		c->datamap ^= bit;
+		c->nodemap |= bit;
+		c->children.insert(c->children.begin() + Index(c->nodemap, bit), Pair(old, e, shift + kBits, edit));
+		*added = true;
+		return c;
+	}
+	if (t->nodemap & bit) {
+		int i = Index(t->nodemap, bit);
+		Trie *child = Assoc(t->children[i], e, shift + kBits, edit, added);
+		if (child == t->children[i]) {
+			return t;
+		}
+		Trie *c = Editable(t, edit);
+		c->children[i] = child;
+		return c;
+	}
+	Trie *c = Editable(t, edit);
+	c->datamap |= bit;
+	c->entries.insert(c->entries.begin() + Index(c->datamap, bit), e);
+	*added = true;
+	return c;
+}
+
+Trie *Dissoc(Trie *t, const Node *key, std::size_t hash, int shift, uint64_t edit, bool *removed) {
+	if (shift >= kMaxShift) {
+		for (std::size_t i = 0; i < t->entries.size(); i++) {
+			if (Same(t->entries[i], key, hash)) {
+				Trie *c = Editable(t, edit);
+				c->entries.erase(c->entries.begin() + i);
+				*removed = true;
+				return c;
+			}
+		}
+		return t;
+	}
+
+	uint32_t bit = Bit(hash, shift);
+	if (t->datamap & bit) {
+		int i = Index(t->datamap, bit);
+		if (!Same(t->entries[i], key, hash)) {
+			return t;
+		}
+		Trie *c = Editable(t, edit);
+		c->entries.erase(c->entries.begin() + i);
+		c->datamap ^= bit;
+		*removed = true;
+		return c;
+	}
+	if (t->nodemap & bit) {
+		int i = Index(t->nodemap, bit);
+		Trie *child = Dissoc(t->children[i], key, hash, shift + kBits, edit, removed);
+		if (child == t->children[i]) {
+			return t;
+		}
+		Trie *c = Editable(t, edit);
+		if (child->nodemap == 0 && child->entries.size() <= 1) {
+			// a child left with one entry is folded into this node,
+			// so each map has a single shape.
+			c->children.erase(c->children.begin() + i);
+			c->nodemap ^= bit;
+			if (child->entries.size() == 1) {
+				c->datamap |= bit;
+				c->entries.insert(c->entries.begin() + Index(c->datamap, bit), child->entries[0]);
+			}
+		} else {
+			c->children[i] = child;
+		}
+		return c;
+	}
+	return t;
+}
+
+void ForEach(const Trie *t, const std::function<void(Node *, Node *)>& fn) {
+	for (auto& i: t->entries) {
+		fn(i.key, i.value);
+	}
+	for (auto i: t->children) {
+		ForEach(i, fn);
+	}
+}
+
+} // namespace
+} // namespace hamt
+
+Node *Hamt::Get(const Node *key) const {
+	if (root_ == nullptr) {
+		return nullptr;
+	}
+	std::size_t hash = key->Hash();
+	const hamt::Trie *t = root_;
+	for (int shift = 0; shift < hamt::kMaxShift; shift += hamt::kBits) {
+		uint32_t bit = hamt::Bit(hash, shift);
+		if (t->datamap & bit) {
+			const hamt::Entry& e = t->entries[hamt::Index(t->datamap, bit)];
+			return hamt::Same(e, key, hash) ? e.value : nullptr;
+		}
+		if ((t->nodemap & bit) == 0) {
+			return nullptr;
+		}
+		t = t->children[hamt::Index(t->nodemap, bit)];
+	}
+	for (auto& e: t->entries) {
+		if (hamt::Same(e, key, hash)) {
+			return e.value;
+		}
+	}
+	return nullptr;
+}
+
+Hamt Hamt::Assoc(Node *key, Node *value) const {
+	Transient t(*this);
+	t.Assoc(key, value);
+	return t.Persistent();
+}
+
+Hamt Hamt::Dissoc(const Node *key) const {
+	Transient t(*this);
+	t.Dissoc(key);
+	return t.Persistent();
+}
+
+void Hamt::ForEach(const std::function<void(Node *, Node *)>& fn) const {
+	if (root_ != nullptr) {
+		hamt::ForEach(root_, fn);
+	}
+}
+
+Hamt::Transient::Transient(const Hamt& from) : root(from.root_), size(from.size_), edit(hamt::next_edit++) {}
+
+void Hamt::Transient::Assoc(Node *key, Node *value) {
+	if (root == nullptr) {
+		root = new hamt::Trie();
+		root->edit = edit;
+	}
+	bool added = false;
+	root = hamt::Assoc(root, hamt::Entry{key, value, key->Hash()}, 0, edit, &added);
+	if (added) {
+		size++;
+	}
+}
+
+void Hamt::Transient::Dissoc(const Node *key) {
+	if (root == nullptr) {
+		return;
+	}
+	bool removed = false;
+	root = hamt::Dissoc(root, key, key->Hash(), 0, edit, &removed);
+	if (removed) {
+		size--;
+	}
+}
+
+Hamt Hamt::Transient::Persistent() {
+	// nodes stamped with this edit are now shared and
+	// are copied by any later transient.
+	edit = 0;
+	return Hamt(size == 0 ? nullptr : root, size);
+}
+
+} // namespace crisp
@@ -0,0 +1,65 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_HAMT_H_
+#define CRISP_HAMT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace crisp {
+
+class Node;
+
+namespace hamt {
+struct Trie;
+} // namespace hamt
+
+// Hamt is a persistent hash map from nodes to nodes, keyed by their
+// structural Hash and Equal. Maps are never changed, updates return
+// a new map sharing every trie node but those on the updated path.
+// nodes are five bits of hash wide, keys whose hashes collide on
+// every bit share a bucket at the bottom of the trie.
+class Hamt {
+public:
+	Hamt() {}
+
+	// returns the value of key or nullptr.
+	Node *Get(const Node *key) const;
+	// returns a map binding key to value.
+	Hamt Assoc(Node *key, Node *value) const;
+	// returns a map without key.
+	Hamt Dissoc(const Node *key) const;
+
+	// calls fn for each binding, in hash order.
+	void ForEach(const std::function<void(Node *key, Node *value)>& fn) const;
+
+	std::size_t size() const { return size_; }
+
+	// Transient builds a map by updating its trie in place.
+	// trie nodes it created are its own and are changed without
+	// copying, those shared with other maps are copied first.
+	class Transient {
+	public:
+		Transient(const Hamt& from);
+		void Assoc(Node *key, Node *value);
+		void Dissoc(const Node *key);
+		// returns the map built, the transient may not be used after.
+		Hamt Persistent();
+	private:
+		hamt::Trie *root;
+		std::size_t size;
+		uint64_t edit;
+	};
+private:
+	Hamt(hamt::Trie *root, std::size_t size) : root_(root), size_(size) {}
+
+	hamt::Trie *root_ = nullptr;
+	std::size_t size_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_HAMT_H_
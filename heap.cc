@@ -0,0 +1,197 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "heap.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <new>
+
+namespace crisp {
+
+namespace {
+
+thread_local Heap *current_heap = nullptr;
+
+// read through these for the same reason as fibers,
+// code holding a heap may be resumed on another thread.
+__attribute__((noinline)) Heap *GetCurrent() {
+	return current_heap;
+}
+
+__attribute__((noinline)) void SetCurrent(Heap *h) {
+	current_heap = h;
+}
+
+// the end of each live heap block by its start.
+std::mutex ranges_mut;
+std::map<std::uintptr_t, std::uintptr_t>& Ranges() {
+	static auto ranges = new std::map<std::uintptr_t, std::uintptr_t>();
+	return *ranges;
+}
+
+// marks a destroyed object by clearing its vtable pointer,
+// so that its heap does not destroy it again.
+void MarkDeleted(void *p) {
+	*static_cast<void **>(p) = nullptr;
+}
+
+bool Deleted(const void *p) {
+	return *static_cast<void *const *>(p) == nullptr;
+}
+
+} // namespace
+
+void *HeapObject::operator new(std::size_t n) {
+	Heap *heap = GetCurrent();
+	return heap != nullptr ? heap->AllocateObject(n) : ::operator new(n);
+}
+
+void HeapObject::operator delete(void *p) {
+	if (!Heap::Owns(p)) {
+		::operator delete(p);
+	} else {
+		MarkDeleted(p);
+	}
+}
+
+Heap::Heap() {
+	Block *b = new Block();
+	b->data = Reserve(kBlockSize);
+	current_ = b;
+}
+
+Heap::~Heap() {
+	// objects are destroyed before any block is freed,
+	// as a destructor may still read another object.
+	for (auto b: retired) {
+		Destroy(reinterpret_cast<HeapObject **>(b->data + kBlockSize) - b->objects, b->objects);
+	}
+	Block *current = current_.load();
+	std::size_t objects = current->used.load() >> kObjectShift;
+	Destroy(reinterpret_cast<HeapObject **>(current->data + kBlockSize) - objects, objects);
+	Destroy(large.data(), large.size());
+	{
+		std::lock_guard<std::mutex> lock(ranges_mut);
+		for (auto b: blocks) {
+			Ranges().erase(reinterpret_cast<std::uintptr_t>(b));
+		}
+	}
+	for (auto b: blocks) {
+		std::free(b);
+	}
+	for (auto b: retired) {
+		delete b;
+	}
+	delete current_.load();
+}
+
+void Heap::Unpin() {
+	if (pins_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		delete this;
+	}
+}
+
+char *Heap::Reserve(std::size_t n) {
+	// malloc aligns for any type, as Allocate promises.
+	char *data = static_cast<char *>(std::malloc(n));
+	if (data == nullptr) {
+		throw std::bad_alloc();
+	}
+	reserved_ += n;
+	blocks.push_back(data);
+	std::lock_guard<std::mutex> lock(ranges_mut);
+	auto start = reinterpret_cast<std::uintptr_t>(data);
+	Ranges()[start] = start + n;
+	return data;
+}
+
+void Heap::Destroy(HeapObject **slots, std::size_t n) {
+	for (std::size_t i = 0; i < n; i++) {
+		if (!Deleted(slots[i])) {
+			slots[i]->~HeapObject();
+		}
+	}
+}
+
+void Heap::Grow(Block *full) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (current_.load() != full) {
+		return;
+	}
+	Block *b = new Block();
+	b->data = Reserve(kBlockSize);
+	// the full block is kept, a racing allocation may still read it.
+	retired.push_back(full);
+	current_ = b;
+}
+
+void *Heap::Allocate(std::size_t n) {
+	return Allocate(n, false);
+}
+
+void *Heap::AllocateObject(std::size_t n) {
+	return Allocate(n, true);
+}
+
+void *Heap::Allocate(std::size_t n, bool object) {
+	n = (n + kAlign - 1) & ~(kAlign - 1);
+	if (n > kBlockSize / 4) {
+		// large allocations get a block of their own.
+		std::lock_guard<std::mutex> lock(mut);
+		char *data = Reserve(n);
+		if (object) {
+			large.push_back(reinterpret_cast<HeapObject *>(data));
+		}
+		return data;
+	}
+	const uint64_t mask = (uint64_t(1) << kObjectShift) - 1;
+	const uint64_t add = n + (object ? uint64_t(1) << kObjectShift : 0);
+	for (;;) {
+		Block *b = current_.load(std::memory_order_acquire);
+		uint64_t prev = b->used.fetch_add(add, std::memory_order_relaxed);
+		std::size_t offset = prev & mask;
+		std::size_t objects = prev >> kObjectShift;
+		if (offset + n + (objects + object) * sizeof(HeapObject *) <= kBlockSize) {
+			if (object) {
+				HeapObject **slots = reinterpret_cast<HeapObject **>(b->data + kBlockSize);
+				slots[-1 - static_cast<std::ptrdiff_t>(objects)] = reinterpret_cast<HeapObject *>(b->data + offset);
+			}
+			return b->data + offset;
+		}
+		if (offset + objects * sizeof(HeapObject *) <= kBlockSize) {
+			// the first allocation that did not fit, every later
+			// one fails too, so the objects before it are all there are.
+			b->objects = objects;
+		}
+		Grow(b);
+	}
+}
+
+Heap *Heap::Current() {
+	return GetCurrent();
+}
+
+bool Heap::Owns(const void *p) {
+	auto addr = reinterpret_cast<std::uintptr_t>(p);
+	std::lock_guard<std::mutex> lock(ranges_mut);
+	auto& ranges = Ranges();
+	auto i = ranges.upper_bound(addr);
+	if (i == ranges.begin()) {
+		return false;
+	}
+	--i;
+	return addr < i->second;
+}
+
+Heap::Use::Use(Heap *heap) : prev(GetCurrent()) {
+	SetCurrent(heap);
+}
+
+Heap::Use::~Use() {
+	SetCurrent(prev);
+}
+
+} // namespace crisp
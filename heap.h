@@ -0,0 +1,118 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_HEAP_H_
+#define CRISP_HEAP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace crisp {
+
+// HeapObject is allocated from the calling thread's current heap,
+// or with the normal allocator when there is none. deleting an object
+// from a heap runs its destructor but leaves its memory to the heap,
+// which destroys the objects still in it when it is destroyed.
+// HeapObject must be the first base of a class.
+class HeapObject {
+public:
+	virtual ~HeapObject() {}
+
+	static void *operator new(std::size_t n);
+	static void operator delete(void *p);
+};
+
+// Heap is a bump allocator for the nodes of one isolate, and for what
+// they share or own such as scopes, map tries and list chunks.
+// nothing allocated from a heap is freed before the heap is,
+// destroying the heap runs the destructors of the objects still in it
+// and frees all of it at once. a long running isolate so keeps every
+// node it has made, it is reclaimed by destroying the isolate.
+// any number of threads may allocate from a heap at the same time.
+//
+// a heap starts pinned once by its owner. the pool's tasks and fibers
+// pin the heap they run with while they may use it, so a heap made
+// with new can be left to them by its owner's Unpin, the last of which
+// deletes it. a heap that is not made with new keeps its owner's pin.
+class Heap {
+public:
+	Heap();
+	~Heap();
+
+	// deleted copy and move constructor.
+	Heap(const Heap&) = delete;
+	Heap(Heap&&) = delete;
+
+	// returns n bytes aligned for any type.
+	void *Allocate(std::size_t n);
+
+	// returns n bytes for a HeapObject, whose destructor the heap runs
+	// when it is destroyed, so storage the object owns, such as its
+	// vectors and strings, is freed with it.
+	void *AllocateObject(std::size_t n);
+
+	void Pin() { pins_.fetch_add(1, std::memory_order_relaxed); }
+	// deletes the heap if that was its last pin.
+	void Unpin();
+
+	// returns the number of bytes reserved from the system.
+	std::size_t reserved() const { return reserved_; }
+
+	// returns the heap nodes are allocated from on this thread,
+	// nullptr means the global heap.
+	static Heap *Current();
+
+	// returns true if p was allocated from a heap that is still alive.
+	static bool Owns(const void *p);
+
+	// makes a heap current on this thread until it goes out of scope.
+	class Use {
+	public:
+		Use(Heap *heap);
+		~Use();
+	private:
+		Heap *prev;
+	};
+private:
+	static const std::size_t kBlockSize = 64 * 1024;
+	static const std::size_t kAlign = alignof(std::max_align_t);
+
+	// a block is filled with allocations from its start and with
+	// pointers to its objects from its end. both are counted in used,
+	// bytes in the low bits and objects above kObjectShift, so one
+	// atomic add claims the space of an object and its slot.
+	static const int kObjectShift = 40;
+	struct Block {
+		std::atomic<uint64_t> used = {0};
+		// the objects that fit, set by the allocation that filled it.
+		std::size_t objects = 0;
+		char *data;
+	};
+
+	void *Allocate(std::size_t n, bool object);
+	// reserves a block of n bytes and registers its range.
+	// must be called with mut held.
+	char *Reserve(std::size_t n);
+	// destroys the n objects slots points to that were not deleted.
+	static void Destroy(HeapObject **slots, std::size_t n);
+
+	// replaces full, unless another thread already has.
+	void Grow(Block *full);
+
+	std::mutex mut;
+	std::vector<char *> blocks;
+	std::vector<Block *> retired;
+	// objects given blocks of their own.
+	std::vector<HeapObject *> large;
+	std::atomic<Block *> current_;
+	std::atomic<std::size_t> reserved_ = {0};
+	std::atomic<std::size_t> pins_ = {1};
+};
+
+} // namespace crisp
+
+#endif // CRISP_HEAP_H_
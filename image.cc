@@ -0,0 +1,418 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "image.h"
+#include "functions.h"
+
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crisp {
+
+namespace {
+
+const char kMagic[] = "CRISPIM1";
+const std::size_t kMagicSize = 8;
+const std::size_t kHeaderSize = kMagicSize + 4 * 8;
+
+enum Tag : uint8_t {
+	kNullTag,
+	kRootTag,
+	kListTag,
+	kIdentTag,
+	kNumTag,
+	kStringTag,
+	kBooleanTag,
+	kErrorTag,
+	kConstTag,
+	kBuiltinTag,
+	kLambdaTag,
+};
+
+} // namespace
+
+ImageWriter::ImageWriter(Node::State *s) : state(s) {
+	if (state == nullptr) {
+		return; // plain trees have no builtins.
+	}
+	auto globals = dynamic_cast<GlobalScope *>(state->symbol_table());
+	if (globals != nullptr) {
+		for (auto i: globals->Bindings()) {
+			if (dynamic_cast<CallNode *>(i.second) != nullptr) {
+				builtins[i.second] = i.first;
+			}
+		}
+	}
+}
+
+void ImageWriter::AddRoot(const std::string& name, Node *node) {
+	uint64_t n = AddString(name);
+	roots.push_back(std::make_pair(n, Add(node)));
+}
+
+void ImageWriter::AddGlobals() {
+	if (state == nullptr) {
+		return;
+	}
+	auto globals = dynamic_cast<GlobalScope *>(state->symbol_table());
+	if (globals == nullptr) {
+		return;
+	}
+	// names bound nearer the state hide those of the fallbacks.
+	std::map<std::string, Node *> bindings = globals->Bindings();
+	for (auto f = globals->fallback(); f != nullptr; ) {
+		if (auto image = dynamic_cast<ImageScope *>(f)) {
+			auto b = image->Bindings();
+			bindings.insert(b.begin(), b.end());
+			break;
+		}
+		auto g = dynamic_cast<GlobalScope *>(f);
+		if (g == nullptr) {
+			break;
+		}
+		auto b = g->Bindings();
+		bindings.insert(b.begin(), b.end());
+		f = g->fallback();
+	}
+	for (auto i: bindings) {
+		auto b = builtins.find(i.second);
+		if (b != builtins.end() && b->second == i.first) {
+			continue; // bound by every state.
+		}
+		AddRoot(i.first, i.second);
+	}
+}
+
+uint64_t ImageWriter::AddString(const std::string& str) {
+	auto i = strings.find(str);
+	if (i != strings.end()) {
+		return i->second;
+	}
+	uint64_t offset = string_table.size();
+	string_table.PutVarint(str.size());
+	string_table.PutBytes(str);
+	strings[str] = offset;
+	return offset;
+}
+
+uint64_t ImageWriter::Add(const Node *node) {
+	auto i = ids.find(node);
+	if (i != ids.end()) {
+		return i->second;
+	}
+	// the index is taken before children are added,
+	// children always follow their parents.
+	uint64_t id = records.size();
+	ids[node] = id;
+	records.push_back(std::string());
+
+	Encoder e;
+	auto b = builtins.find(node);
+	if (node == nullptr || dynamic_cast<const NullNode *>(node) != nullptr) {
+		e.PutByte(kNullTag);
+	} else if (b != builtins.end()) {
+		e.PutByte(kBuiltinTag);
+		e.PutVarint(AddString(b->second));
+	} else if (auto p = dynamic_cast<const ParentNode *>(node)) {
+		if (auto c = dynamic_cast<const ConstNode *>(node)) {
+			e.PutByte(kConstTag);
+			e.PutVarint(Add(c->Eval(nullptr)));
+		} else {
+			e.PutByte(dynamic_cast<const ListNode *>(node) != nullptr ? kListTag : kRootTag);
+			e.PutVarint(p->children().size());
+			for (auto i: p->children()) {
+				e.PutVarint(Add(i));
+			}
+		}
+	} else if (auto n = dynamic_cast<const IdentNode *>(node)) {
+		e.PutByte(kIdentTag);
+		e.PutVarint(AddString(n->str()));
+	} else if (auto n = dynamic_cast<const NumNode *>(node)) {
+		e.PutByte(kNumTag);
+		e.PutSigned(n->num());
+	} else if (auto n = dynamic_cast<const StringNode *>(node)) {
+		e.PutByte(kStringTag);
+		e.PutVarint(AddString(n->str().ToString()));
+	} else if (auto n = dynamic_cast<const BooleanNode *>(node)) {
+		e.PutByte(kBooleanTag);
+		e.PutByte(n->value());
+	} else if (auto n = dynamic_cast<const LambdaFunc::Instance *>(node)) {
+		// the captured scope is dropped, the loader binds to its globals.
+		e.PutByte(kLambdaTag);
+		e.PutVarint(Add(n->param()));
+		e.PutVarint(Add(n->body()));
+	} else if (dynamic_cast<const ErrorNode *>(node) != nullptr) {
+		e.PutByte(kErrorTag);
+		e.PutVarint(AddString(node->PPrint()));
+	} else {
+		// runtime values such as channels and futures.
+		unsupported_++;
+		e.PutByte(kErrorTag);
+		e.PutVarint(AddString(std::string("image: cannot serialize '") + node->PPrint() + "'"));
+	}
+	records[id] = e.data();
+	return id;
+}
+
+std::string ImageWriter::Encode() const {
+	Encoder e;
+	e.PutBytes(std::string(kMagic, kMagicSize));
+	std::size_t header = e.size();
+	for (int i = 0; i < 4; i++) {
+		e.PutFixed64(0);
+	}
+
+	uint64_t strings_off = e.size();
+	e.PutBytes(string_table.data());
+
+	std::vector<uint64_t> offsets;
+	for (auto& i: records) {
+		offsets.push_back(e.size());
+		e.PutBytes(i);
+	}
+
+	uint64_t index_off = e.size();
+	for (auto i: offsets) {
+		e.PutFixed64(i);
+	}
+
+	uint64_t roots_off = e.size();
+	e.PutVarint(roots.size());
+	for (auto& i: roots) {
+		e.PutVarint(i.first);
+		e.PutVarint(i.second);
+	}
+
+	e.PatchFixed64(header, strings_off);
+	e.PatchFixed64(header + 8, index_off);
+	e.PatchFixed64(header + 16, roots_off);
+	e.PatchFixed64(header + 24, records.size());
+	return e.data();
+}
+
+bool ImageWriter::Write(const std::string& path) const {
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	std::string data = Encode();
+	out.write(data.data(), data.size());
+	return out.good();
+}
+
+Image *Image::Open(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+	void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		return nullptr;
+	}
+	Image *image = new Image(static_cast<const char *>(m), st.st_size);
+	image->mapping = m;
+	if (!image->ok()) {
+		delete image;
+		return nullptr;
+	}
+	return image;
+}
+
+Image::Image(const char *data, std::size_t size) : data_(data), size_(size) {
+	if (size < kHeaderSize || std::string(data, kMagicSize) != std::string(kMagic, kMagicSize)) {
+		return;
+	}
+	Decoder d(data, size);
+	d.Seek(kMagicSize);
+	uint64_t roots_off;
+	d.GetFixed64(&strings_off);
+	d.GetFixed64(&index_off);
+	d.GetFixed64(&roots_off);
+	d.GetFixed64(&node_count);
+	if (!d.ok() || index_off > size || node_count > (size - index_off) / 8) {
+		return;
+	}
+
+	// only the root names are read up front.
+	d.Seek(roots_off);
+	uint64_t count;
+	d.GetVarint(&count);
+	for (uint64_t i = 0; i < count && d.ok(); i++) {
+		uint64_t name, node;
+		std::string str;
+		d.GetVarint(&name);
+		d.GetVarint(&node);
+		if (!d.ok() || node >= node_count || !ReadString(name, &str)) {
+			return;
+		}
+		roots_[str] = node;
+	}
+	if (!d.ok()) {
+		return;
+	}
+	nodes = std::vector<std::atomic<Node *>>(node_count);
+	for (auto& i: nodes) {
+		i.store(nullptr, std::memory_order_relaxed);
+	}
+	decoding.assign(node_count, false);
+	ok_ = true;
+}
+
+Image::~Image() {
+	if (mapping != nullptr) {
+		munmap(mapping, size_);
+	}
+}
+
+bool Image::ReadString(uint64_t offset, std::string *str) const {
+	Decoder d(data_, size_);
+	d.Seek(strings_off + offset);
+	uint64_t n;
+	return d.GetVarint(&n) && d.GetBytes(n, str);
+}
+
+std::vector<std::string> Image::roots() const {
+	std::vector<std::string> names;
+	for (auto& i: roots_) {
+		names.push_back(i.first);
+	}
+	return names;
+}
+
+Node *Image::Root(const std::string& name, Node::State *state) {
+	auto i = roots_.find(name);
+	if (!ok_ || i == roots_.end()) {
+		return nullptr;
+	}
+	Node *n = nodes[i->second].load(std::memory_order_acquire);
+	if (n != nullptr) {
+		return n;
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	return Decode(i->second, state);
+}
+
+Node *Image::Decode(uint64_t index, Node::State *state) {
+	if (index >= node_count) {
+		return new ErrorNode("image: bad node index");
+	}
+	Node *n = nodes[index].load(std::memory_order_acquire);
+	if (n != nullptr) {
+		return n;
+	}
+	if (decoding[index]) {
+		return new ErrorNode("image: cyclic node");
+	}
+	decoding[index] = true;
+
+	Decoder d(data_, size_);
+	uint64_t offset;
+	d.Seek(index_off + 8 * index);
+	d.GetFixed64(&offset);
+	d.Seek(offset);
+
+	uint8_t tag = 0;
+	uint64_t a = 0, b = 0;
+	int64_t num = 0;
+	std::string str;
+	d.GetByte(&tag);
+	switch (tag) {
+	case kNullTag:
+		n = new NullNode();
+		break;
+	case kRootTag:
+	case kListTag: {
+		ParentNode *p = tag == kListTag ? static_cast<ParentNode *>(new ListNode()) : new RootNode();
+		d.GetVarint(&a);
+		for (uint64_t i = 0; i < a && d.ok(); i++) {
+			d.GetVarint(&b);
+			p->Put(Decode(b, state));
+		}
+		n = p;
+		break;
+	}
+	case kIdentTag:
+		d.GetVarint(&a);
+		n = ReadString(a, &str) ? new IdentNode(str) : nullptr;
+		break;
+	case kNumTag:
+		d.GetSigned(&num);
+		n = new NumNode(num);
+		break;
+	case kStringTag:
+		d.GetVarint(&a);
+		n = ReadString(a, &str) ? new StringNode(str) : nullptr;
+		break;
+	case kBooleanTag: {
+		uint8_t v = 0;
+		d.GetByte(&v);
+		n = new BooleanNode(v != 0);
+		break;
+	}
+	case kErrorTag:
+		d.GetVarint(&a);
+		n = ReadString(a, &str) ? new ErrorNode(str) : nullptr;
+		break;
+	case kConstTag: {
+		auto c = new ConstNode();
+		d.GetVarint(&a);
+		c->Put(Decode(a, state));
+		n = c;
+		break;
+	}
+	case kBuiltinTag:
+		d.GetVarint(&a);
+		if (ReadString(a, &str)) {
+			n = state->symbol_table()->Get(str);
+			if (n == nullptr) {
+				n = new ErrorNode(std::string("image: no builtin '") + str + "'");
+			}
+		}
+		break;
+	case kLambdaTag: {
+		d.GetVarint(&a);
+		d.GetVarint(&b);
+		auto param = dynamic_cast<IdentNode *>(Decode(a, state));
+		if (param != nullptr) {
+			n = new LambdaFunc::Instance(state->symbol_table(), param, Decode(b, state));
+		}
+		break;
+	}
+	}
+	if (!d.ok() || n == nullptr) {
+		n = new ErrorNode("image: corrupt node");
+	}
+	decoding[index] = false;
+	nodes[index].store(n, std::memory_order_release);
+	return n;
+}
+
+Node *ImageScope::Get(std::string str) {
+	return image_->Root(str, state_);
+}
+
+std::map<std::string, Node *> ImageScope::Bindings() const {
+	std::map<std::string, Node *> bindings;
+	for (auto& i: image_->roots()) {
+		bindings[i] = image_->Root(i, state_);
+	}
+	return bindings;
+}
+
+std::string ImageScope::PPrint() const {
+	std::string s;
+	for (auto& i: image_->roots()) {
+		s += i + ": " + image_->Root(i, state_)->PPrint() + '\n';
+	}
+	return s;
+}
+
+} // namespace crisp
@@ -0,0 +1,136 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_IMAGE_H_
+#define CRISP_IMAGE_H_
+
+#include "tree.h"
+#include "codec.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace crisp {
+
+// Images hold a graph of nodes reachable from a set of named roots.
+// Nodes refer to each other by index and to strings by their offset in
+// a string table, so an image has no pointers and can be mapped at any
+// address. Builtins are stored by the name they are bound to, and are
+// resolved against the state an image is loaded into. Lambdas are stored
+// as their parameter and body only, the scope a closure captured is not
+// serialized, so a loaded lambda looks up free names in the globals.
+//
+// Layout, after an 8 byte magic and a header of fixed64 section offsets:
+//   strings: varint length and bytes per string.
+//   nodes:   a tag byte and varint fields per node.
+//   index:   the fixed64 offset of each node.
+//   roots:   varint count, then a name string and node index per root.
+
+// ImageWriter serializes nodes into an image.
+class ImageWriter {
+public:
+	// builtins are named by their binding in state's globals,
+	// state may be nullptr for trees without builtins.
+	ImageWriter(Node::State *state);
+
+	void AddRoot(const std::string& name, Node *node);
+
+	// adds every global definition of the state, except builtins,
+	// including those of the images and scopes its globals fall back on.
+	void AddGlobals();
+
+	// returns the encoded image.
+	std::string Encode() const;
+
+	// writes the image to path, returning false on failure.
+	bool Write(const std::string& path) const;
+
+	// returns the number of nodes that could not be serialized,
+	// they are stored as errors.
+	int unsupported() const { return unsupported_; }
+private:
+	// returns the index of node, adding it and the nodes it reaches.
+	uint64_t Add(const Node *node);
+	uint64_t AddString(const std::string& str);
+
+	Node::State *state;
+	std::unordered_map<const Node *, std::string> builtins;
+	std::unordered_map<const Node *, uint64_t> ids;
+	std::unordered_map<std::string, uint64_t> strings;
+	Encoder string_table;
+	std::vector<std::string> records;
+	std::vector<std::pair<uint64_t, uint64_t>> roots;
+	int unsupported_ = 0;
+};
+
+// Image is an image file mapped into memory.
+// Nodes are decoded on first use and shared from then on.
+class Image {
+public:
+	// maps the image at path, returning nullptr if it is missing or invalid.
+	static Image *Open(const std::string& path);
+
+	// wraps an image held in memory, data must outlive the image.
+	Image(const char *data, std::size_t size);
+	~Image();
+
+	// deleted copy and move constructor.
+	Image(const Image&) = delete;
+	Image(Image&&) = delete;
+
+	bool ok() const { return ok_; }
+
+	// returns the node of root name, or nullptr.
+	// lambdas and builtins are bound to state.
+	Node *Root(const std::string& name, Node::State *state);
+
+	// returns the names of the roots.
+	std::vector<std::string> roots() const;
+private:
+	// decodes the node at index, must hold mut.
+	Node *Decode(uint64_t index, Node::State *state);
+	bool ReadString(uint64_t offset, std::string *str) const;
+
+	const char *data_;
+	std::size_t size_;
+	void *mapping = nullptr;
+	bool ok_ = false;
+
+	uint64_t strings_off = 0;
+	uint64_t index_off = 0;
+	uint64_t node_count = 0;
+	std::map<std::string, uint64_t> roots_;
+
+	// decoded nodes by index.
+	std::mutex mut;
+	std::vector<std::atomic<Node *>> nodes;
+	// marks the nodes being decoded, so that a corrupt image whose
+	// nodes refer back to themselves fails instead of recursing forever.
+	std::vector<bool> decoding;
+};
+
+// symbol table of the roots of an image,
+// used as the fallback of a state's globals.
+class ImageScope : public Node::State::SymbolTableInterface {
+public:
+	ImageScope(Image *image, Node::State *state) : image_(image), state_(state) {}
+	// definitions belong in the globals, the image is read only.
+	virtual void Put(std::string str, Node *node) {}
+	virtual Node *Get(std::string str);
+	virtual std::string PPrint() const;
+
+	// returns the roots of the image by name.
+	std::map<std::string, Node *> Bindings() const;
+private:
+	Image *image_;
+	Node::State *state_;
+};
+
+} // namespace crisp
+
+#endif // CRISP_IMAGE_H_
@@ -0,0 +1,42 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "intern.h"
+
+#include <functional>
+
+namespace crisp {
+
+std::size_t Interner::ShallowHash::operator()(const Node *node) const {
+	auto l = dynamic_cast<const ListNode *>(node);
+	if (l == nullptr) {
+		return node->Hash();
+	}
+	// children are canonical, so their addresses identify them.
+	std::size_t h = l->children().size();
+	for (auto i: l->children()) {
+		h ^= std::hash<const Node *>()(i) + 0x9e3779b9 + (h << 6) + (h >> 2);
+	}
+	return h;
+}
+
+bool Interner::ShallowEqual::operator()(const Node *a, const Node *b) const {
+	auto la = dynamic_cast<const ListNode *>(a);
+	auto lb = dynamic_cast<const ListNode *>(b);
+	if (la == nullptr || lb == nullptr) {
+		return la == lb && a->Equal(b);
+	}
+	return la->children() == lb->children();
+}
+
+Node *Interner::Intern(Node *node) {
+	auto i = table.insert(node);
+	if (!i.second) {
+		delete node;
+		shared_++;
+	}
+	return *i.first;
+}
+
+} // namespace crisp
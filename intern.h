@@ -0,0 +1,44 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_INTERN_H_
+#define CRISP_INTERN_H_
+
+#include "tree.h"
+
+#include <unordered_set>
+
+namespace crisp {
+
+// table of canonical immutable nodes, used to hash-cons parsed trees
+// so that structurally equal subtrees share a single node.
+// lists must be interned after their children, which lets lists be
+// hashed and compared by the identity of their (canonical) children.
+// the table does not own its nodes, it only refers to them.
+class Interner {
+public:
+	// returns the canonical node structurally equal to node.
+	// if one already exists node is deleted.
+	Node *Intern(Node *node);
+
+	// returns the number of canonical nodes.
+	std::size_t size() const { return table.size(); }
+
+	// returns the number of nodes replaced by a canonical node.
+	unsigned long shared() const { return shared_; }
+private:
+	struct ShallowHash {
+		std::size_t operator()(const Node *node) const;
+	};
+	struct ShallowEqual {
+		bool operator()(const Node *a, const Node *b) const;
+	};
+
+	std::unordered_set<Node *, ShallowHash, ShallowEqual> table;
+	unsigned long shared_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_INTERN_H_
@@ -0,0 +1,119 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "io.h"
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace crisp {
+
+namespace {
+
+metrics::Counter bytes_written("crisp_output_bytes_total", "Bytes written out by scripts.");
+metrics::Counter flushes("crisp_output_flushes_total", "Blocks of script output written to their descriptor.");
+
+thread_local Output *current_output = nullptr;
+
+} // namespace
+
+Output::Output(int d, std::size_t c) : fd(d), capacity(c) {
+	buf.reserve(capacity);
+}
+
+Output::Output() : fd(-1), capacity(0) {
+}
+
+Output::~Output() {
+	Flush();
+}
+
+bool Output::Write(StringPiece s) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (!error_.empty()) {
+		return false;
+	}
+	if (fd < 0 || buf.size() + s.size() <= capacity) {
+		buf.append(s.data(), s.size());
+		return true;
+	}
+	if (!WriteAll(buf.data(), buf.size())) {
+		return false;
+	}
+	buf.clear();
+	if (s.size() >= capacity) {
+		return WriteAll(s.data(), s.size());
+	}
+	buf.append(s.data(), s.size());
+	return true;
+}
+
+bool Output::Flush() {
+	std::lock_guard<std::mutex> lock(mut);
+	if (!error_.empty()) {
+		return false;
+	} else if (fd < 0) {
+		return true;
+	}
+	bool ok = WriteAll(buf.data(), buf.size());
+	buf.clear();
+	return ok;
+}
+
+std::string Output::error() const {
+	std::lock_guard<std::mutex> lock(mut);
+	return error_;
+}
+
+bool Output::WriteAll(const char *p, std::size_t n) {
+	if (n == 0) {
+		return true;
+	}
+	flushes.Inc();
+	while (n > 0) {
+		ssize_t w = write(fd, p, n);
+		if (w < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error_ = std::strerror(errno);
+			return false;
+		}
+		bytes_written.Inc(w);
+		p += w;
+		n -= w;
+	}
+	return true;
+}
+
+std::string Output::Take() {
+	std::lock_guard<std::mutex> lock(mut);
+	std::string s;
+	if (fd < 0) {
+		s.swap(buf);
+	}
+	return s;
+}
+
+Output *Output::Stdout() {
+	// owned by a shared_ptr so fibers can hold on to it like any other.
+	static std::shared_ptr<Output> *out = new std::shared_ptr<Output>(new Output(STDOUT_FILENO));
+	return out->get();
+}
+
+Output *Output::Current() {
+	return current_output != nullptr ? current_output : Stdout();
+}
+
+Output::Use::Use(Output *output) : prev(current_output) {
+	current_output = output;
+}
+
+Output::Use::~Use() {
+	current_output = prev;
+}
+
+} // namespace crisp
@@ -0,0 +1,75 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_IO_H_
+#define CRISP_IO_H_
+
+#include "piece.h"
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace crisp {
+
+// Output collects writes to a file descriptor and passes them on in
+// large blocks, so scripts writing a line at a time make few system
+// calls. writes larger than the buffer go straight through.
+// it is safe to write from several threads.
+class Output : public std::enable_shared_from_this<Output> {
+public:
+	static const std::size_t kDefaultCapacity = 64 * 1024;
+
+	Output(int fd, std::size_t capacity = kDefaultCapacity);
+	// an output that keeps everything written until it is taken.
+	Output();
+	// flushes what is buffered, the descriptor is not closed.
+	~Output();
+
+	// deleted copy and move constructor.
+	Output(const Output&) = delete;
+	Output(Output&&) = delete;
+
+	// returns false if the descriptor could not be written,
+	// error() then says why.
+	bool Write(StringPiece s);
+	bool Flush();
+
+	std::string error() const;
+
+	// returns and clears what an output without a descriptor holds.
+	std::string Take();
+
+	// returns the output to standard out, shared by the process.
+	static Output *Stdout();
+
+	// returns the output scripts on this thread write to,
+	// standard out unless one is in use. fibers keep the
+	// output of the thread they were spawned from.
+	static Output *Current();
+
+	// Use makes an output current for its lifetime, the output
+	// must be owned by a shared_ptr. uses nest.
+	class Use {
+	public:
+		Use(Output *output);
+		~Use();
+	private:
+		Output *prev;
+	};
+private:
+	// writes out n bytes of p, mut must be held.
+	bool WriteAll(const char *p, std::size_t n);
+
+	const int fd;
+	const std::size_t capacity;
+	mutable std::mutex mut;
+	std::string buf;
+	std::string error_;
+};
+
+} // namespace crisp
+
+#endif // CRISP_IO_H_
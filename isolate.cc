@@ -0,0 +1,93 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "isolate.h"
+#include "parser.h"
+
+#include <sstream>
+
+namespace crisp {
+
+namespace {
+
+// steps a script runs before it yields its worker.
+const uint64_t kQuantum = 10000;
+
+} // namespace
+
+Node *Isolate::Result::Await() {
+	pool->HelpUntil([this]() { return done_.load(); });
+	return value;
+}
+
+Isolate::Isolate(WorkerPool *p, Node::State *prelude) : pool(p), globals(new GlobalScope()) {
+	if (prelude != nullptr) {
+		globals->set_fallback(prelude->symbol_table());
+	}
+	state_ = new Node::State(globals);
+	// the state's own builtins, such as memo, go with the heap.
+	Heap::Use use(&heap_);
+	state_->RegisterBuiltins();
+}
+
+Isolate::~Isolate() {
+	pool->HelpUntil([this]() {
+		std::lock_guard<std::mutex> lock(mut);
+		return !scheduled;
+	});
+	// the last script's fiber is past its last use of eval.
+	eval.reset();
+	delete state_;
+	delete globals;
+}
+
+std::shared_ptr<Isolate::Result> Isolate::Submit(const std::string& script) {
+	std::shared_ptr<Result> result(new Result(pool));
+	bool schedule;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		jobs.push_back(Job{script, result});
+		schedule = !scheduled;
+		scheduled = true;
+	}
+	if (schedule) {
+		pool->Submit([this]() { RunNext(); });
+	}
+	return result;
+}
+
+void Isolate::RunNext() {
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		running = std::move(jobs.front());
+		jobs.pop_front();
+	}
+
+	Heap::Use use(&heap_);
+	std::istringstream in(running.script);
+	Node *tree = parser::Parse(&in, false);
+	// the previous script's fiber is done with its eval once it
+	// has scheduled this task.
+	eval.reset(new MeteredEval(pool, tree, state_, kQuantum, 0, true, [this](Node *value) {
+		Finish(value);
+	}));
+}
+
+void Isolate::Finish(Node *value) {
+	std::shared_ptr<Result> result = std::move(running.result);
+	result->value = value;
+	result->done_ = true;
+
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		if (jobs.empty()) {
+			scheduled = false;
+			return;
+		}
+	}
+	// one task per script, so isolates take turns on the workers.
+	pool->Submit([this]() { RunNext(); });
+}
+
+} // namespace crisp
@@ -0,0 +1,97 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_ISOLATE_H_
+#define CRISP_ISOLATE_H_
+
+#include "fuel.h"
+#include "heap.h"
+#include "pool.h"
+#include "tree.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace crisp {
+
+// Isolate is an interpreter instance with its own heap and globals.
+// isolates share the builtins, and the globals of an optional
+// prelude state which they read but never define in.
+// the scripts submitted to an isolate run one at a time, in order,
+// on fibers of a worker pool shared with other isolates. a script
+// yields its worker after every quantum of steps, so a long script
+// does not hold up the scripts of other isolates.
+//
+// nodes made by a script live in the isolate's heap and are destroyed
+// with it. none are freed before then, so a long lived isolate grows
+// with every script it runs and is best replaced now and then. prelude values that keep what they are given, such as
+// channels, must not hand those nodes to other isolates, and the
+// futures and fibers a script starts must finish before the isolate
+// is destroyed.
+class Isolate {
+public:
+	Isolate(WorkerPool *pool, Node::State *prelude = nullptr);
+
+	// waits for the submitted scripts to run, then frees the heap.
+	~Isolate();
+
+	// deleted copy and move constructor.
+	Isolate(const Isolate&) = delete;
+	Isolate(Isolate&&) = delete;
+
+	// the outcome of a submitted script.
+	class Result {
+	public:
+		// returns the value of the script once it has run,
+		// helping the pool while it waits.
+		// the value is valid until the isolate is destroyed.
+		Node *Await();
+
+		bool done() const { return done_; }
+	private:
+		friend class Isolate;
+		Result(WorkerPool *p) : pool(p) {}
+
+		WorkerPool *pool;
+		Node *value = nullptr;
+		std::atomic<bool> done_ = {false};
+	};
+
+	// queues script to run after those already submitted.
+	std::shared_ptr<Result> Submit(const std::string& script);
+
+	Node::State *state() { return state_; }
+	Heap *heap() { return &heap_; }
+private:
+	struct Job {
+		std::string script;
+		std::shared_ptr<Result> result;
+	};
+
+	// starts the oldest queued job, which schedules the next if any
+	// once it is done.
+	void RunNext();
+	// records the value of the running job and schedules the next.
+	void Finish(Node *value);
+
+	WorkerPool *pool;
+	Heap heap_;
+	GlobalScope *globals;
+	Node::State *state_;
+
+	std::mutex mut;
+	std::deque<Job> jobs;
+	// true while a task of this isolate is queued or running.
+	bool scheduled = false;
+	// the job being run, touched only by the job's own tasks.
+	Job running;
+	std::unique_ptr<MeteredEval> eval;
+};
+
+} // namespace crisp
+
+#endif // CRISP_ISOLATE_H_
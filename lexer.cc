@@ -4,6 +4,7 @@
 // found in the LICENSE file.
 
 #include "lexer.h"
+#include "utf8.h"
 
 #include <utility>
 #include <sstream>
@@ -14,16 +15,84 @@ namespace lexer {
 
 const std::string Ident::legal = "#+-*/`~!@$%^&*_=|?\\:<>,.";
 
+namespace {
+
+bool IsMultibyte(char c) {
+	return static_cast<unsigned char>(c) >= 0x80;
+}
+
+// reads the rest of the character whose first byte c was just scanned.
+// if it is well formed and pred accepts it, its bytes are appended to buf.
+// otherwise the bytes after c are backed up and false is returned.
+bool TakeRune(ScannerInterface *scanner, char c, std::string *buf, bool (*pred)(char32_t)) {
+	int len = utf8::SequenceLength(c);
+	if (len < 2) {
+		return false;
+	}
+	char seq[4] = {c};
+	int n = 1;
+	while (n < len && (seq[n] = scanner->Next()) != EOF) {
+		n++;
+	}
+	char32_t rune;
+	if (utf8::Decode(seq, n, &rune) == len && pred(rune)) {
+		buf->append(seq, len);
+		return true;
+	}
+	while (n > 1) {
+		scanner->Back(seq[--n]);
+	}
+	return false;
+}
+
+bool AnyRune(char32_t) {
+	return true;
+}
+
+} // namespace
+
 Lexer::Lexer(ScannerInterface *s) : mach(s) {}
 
+bool Ident::IsDelim(ScannerInterface *scanner) {
+	char c = scanner->Peek();
+	if (!IsMultibyte(c)) {
+		return Is(c);
+	}
+	std::string rune;
+	bool start = TakeRune(scanner, scanner->Next(), &rune, utf8::IsIdentStart);
+	for (auto i = rune.rbegin(); i != rune.rend(); ++i) {
+		scanner->Back(*i);
+	}
+	if (!start) {
+		scanner->Back(c);
+	}
+	return start;
+}
+
+int Ident::RuneLength(const char *p, std::size_t n, bool initial) {
+	char32_t rune;
+	int len = utf8::Decode(p, n, &rune);
+	if (len == 0 || !(initial ? utf8::IsIdentStart(rune) : utf8::IsIdentContinue(rune))) {
+		return 0;
+	}
+	return len;
+}
+
 StateInterface *Ident::Next() {
 	char c = s->scanner->Next();
 	s->pos = s->scanner->pos();
-	do {
-		s->buf.push_back(c);
-	} while (Is((c = s->scanner->Next())) && c != EOF);
+	for (;;) {
+		// ASCII stays on the fast path, other characters
+		// are decoded and checked against the Unicode classes.
+		if (Is(c)) {
+			s->buf.push_back(c);
+		} else if (!IsMultibyte(c) || !TakeRune(s->scanner, c, &s->buf, utf8::IsIdentContinue)) {
+			break;
+		}
+		c = s->scanner->Next();
+	}
 	s->scanner->Back(c);
-	s->toks.push(new Token(Token::kIdent, s->pos, s->buf));
+	s->toks.push(new Token(Token::kIdent, s->pos, std::move(s->buf)));
 	s->buf.clear();
 	return new SExpression(s);
 }
@@ -35,7 +104,7 @@ StateInterface *Num::Next() {
 		s->buf.push_back(c);
 	} while (Is((c = s->scanner->Next())) && c != EOF);
 	s->scanner->Back(c);
-	s->toks.push(new Token(Token::kNum, s->pos, s->buf));
+	s->toks.push(new Token(Token::kNum, s->pos, std::move(s->buf)));
 	s->buf.clear();
 	return new SExpression(s);
 }
@@ -74,7 +143,7 @@ StateInterface *SExpression::Next() {
 		return new Whitespace(s, new SExpression(s));
 	} else if (Comment::IsDelim(c)) {
 		return new Comment(s, new SExpression(s));
-	} else if (Ident::IsDelim(c)) {
+	} else if (Ident::IsDelim(c) || (IsMultibyte(c) && c != EOF && Ident::IsDelim(s->scanner))) {
 		return new Ident(s);
 	} else if (Num::IsDelim(c)) {
 		return new Num(s);
@@ -83,15 +152,21 @@ StateInterface *SExpression::Next() {
 	} else if (String::IsDelim(c)) {
 		return new String(s, new SExpression(s));
 	} else if (c == EOF) {
-		if (s->paren_depth > 0) {
+		if (!s->scanner->error().empty()) {
+			s->toks.push(new Token(Token::kError, s->scanner->pos(), s->scanner->error()));
+		} else if (s->paren_depth > 0) {
 			std::stringstream str;
 			str << "unexpected EOF";
 			s->toks.push(new Token(Token::kError, s->scanner->pos(), str.str()));
 		}
 		return nullptr;
 	} else {
+		std::string rune;
+		if (!TakeRune(s->scanner, c = s->scanner->Next(), &rune, AnyRune)) {
+			rune.assign(1, c);
+		}
 		std::stringstream str;
-		str << "unexpected character '" << c << "'";
+		str << "unexpected character '" << rune << "'";
 		s->toks.push(new Token(Token::kError, s->scanner->pos(), str.str()));
 		return nullptr;
 	}
@@ -115,10 +190,10 @@ StateInterface *Comment::Next() {
 	s->pos = s->scanner->pos();
 	// lex #stuffstuff\n comment,
 	// don't save delimiter '#' character
-	while ((c = s->scanner->Next()) != '\n') {
+	while ((c = s->scanner->Next()) != '\n' && c != EOF) {
 		s->buf.push_back(c);
 	}
-	s->toks.push(new Token(Token::kComment, s->pos, s->buf));
+	s->toks.push(new Token(Token::kComment, s->pos, std::move(s->buf)));
 	s->buf.clear();
 	return next;
 }
@@ -127,11 +202,17 @@ StateInterface *String::Next() {
 	char c = s->scanner->Next();
 	char delim = c; // " or '
 	s->pos = s->scanner->pos();
-	// lex "stuff" sans ""
+	// lex "stuff" sans "", the buffer is moved into the token.
 	while ((c = s->scanner->Next()) != delim) {
+		if (c == EOF) {
+			s->buf.clear();
+			std::string err = s->scanner->error();
+			s->toks.push(new Token(Token::kError, s->scanner->pos(), err.empty() ? "unexpected EOF in string" : err));
+			return nullptr;
+		}
 		s->buf.push_back(c);
 	}
-	s->toks.push(new Token(Token::kString, s->pos, s->buf));
+	s->toks.push(new Token(Token::kString, s->pos, std::move(s->buf)));
 	s->buf.clear();
 	return next;
 }
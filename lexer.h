@@ -45,8 +45,25 @@ public:
 	static bool IsDelim(char c) {
 		return Is(c);
 	}
+
+	// is the next, non-ASCII, character of the scanner an initial
+	// character. the scanner is left where it was.
+	static bool IsDelim(ScannerInterface *scanner);
+
+	// returns the length in bytes of the ident character at the
+	// start of p[0, n), or 0 if there is none. initial selects the
+	// class of first characters.
+	static int Length(const char *p, std::size_t n, bool initial) {
+		if (static_cast<unsigned char>(*p) < 0x80) {
+			return Is(*p) ? 1 : 0;
+		}
+		return RuneLength(p, n, initial);
+	}
+
 	virtual StateInterface *Next();
 private:
+	static int RuneLength(const char *p, std::size_t n, bool initial);
+
 	// is ident character
 	static bool Is(char c) {
 		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || legal.find(c) != std::string::npos;
@@ -65,13 +82,14 @@ public:
 		return (c >= '0' && c <= '9');
 	}
 
-	virtual StateInterface *Next();
-private:
 	// is a numeric character
 	static bool Is(char c) {
 		return (c >= '0' && c <= '9') || c == '_';
 	}
 
+	virtual StateInterface *Next();
+private:
+
 	SharedStateData *s;
 };
 
@@ -1,51 +1,241 @@
 
-#include "lexer.h"
 #include "parser.h"
-#include "channel.h"
+#include "optimize.h"
+#include "expand.h"
+#include "module.h"
+#include "session.h"
+#include "image.h"
+#include "astcache.h"
+#include "server.h"
+#include "printer.h"
+#include "profile.h"
+#include "metrics.h"
+#include "fuel.h"
+#include "io.h"
 
+#include <fstream>
 #include <sstream>
-#include <future>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <memory>
+#include <vector>
 
 using namespace crisp;
 
-int main() {
-	InputScanner scanner(&std::cin);
-	lexer::Lexer lex(&scanner);
-	parser::Parser p;
-	Channel<Token *> chan(5);
+int main(int argc, char **argv) {
+	bool hash_cons = false;
+	bool optimize = false;
+	std::string image_in, image_out;
+	std::string cache_dir, path;
+	std::vector<std::string> module_path;
+	std::string socket_path;
+	std::string profile_out;
+	std::string metrics_out;
+	int metrics_interval = 10;
+	uint64_t fuel = 0, fuel_allocations = 0;
+	bool profile = false;
+	bool live = false;
+	int print_depth = 0, print_length = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--hash-cons") == 0) {
+			// share structurally equal subtrees of the input.
+			hash_cons = true;
+		} else if (strcmp(argv[i], "--optimize") == 0) {
+			// rewrite the tree before evaluating it.
+			optimize = true;
+		} else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+			// start from the definitions of an image.
+			image_in = argv[++i];
+		} else if (strcmp(argv[i], "--write-image") == 0 && i + 1 < argc) {
+			// save the definitions to an image after evaluating.
+			image_out = argv[++i];
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			// keep parsed trees of source files in a directory.
+			cache_dir = argv[++i];
+		} else if (strcmp(argv[i], "--module-path") == 0 && i + 1 < argc) {
+			// search a directory for required modules, after those given before.
+			module_path.push_back(argv[++i]);
+		} else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			// evaluate the input as a prelude, then serve
+			// requests on a unix socket.
+			socket_path = argv[++i];
+		} else if (strcmp(argv[i], "--live") == 0) {
+			// keep definitions across requests, and evaluate again
+			// the forms that depend on a name when it is rebound.
+			live = true;
+		} else if (strcmp(argv[i], "--print-depth") == 0 && i + 1 < argc) {
+			// elide lists nested deeper than this in the output.
+			print_depth = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--print-length") == 0 && i + 1 < argc) {
+			// elide list items past this many in the output.
+			print_length = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--profile") == 0) {
+			// report the time spent in each function to stderr.
+			profile = true;
+		} else if (strcmp(argv[i], "--profile-stacks") == 0 && i + 1 < argc) {
+			// write the profiled call stacks, collapsed for flamegraphs.
+			profile_out = argv[++i];
+		} else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+			// write metrics to a file periodically, on SIGUSR1 and at exit.
+			metrics_out = argv[++i];
+		} else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+			// seconds between metrics writes, 0 writes only on signal.
+			metrics_interval = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc) {
+			// cancel evaluation after this many calls.
+			fuel = strtoull(argv[++i], nullptr, 10);
+		} else if (strcmp(argv[i], "--fuel-allocations") == 0 && i + 1 < argc) {
+			// cancel evaluation after this many node allocations.
+			fuel_allocations = strtoull(argv[++i], nullptr, 10);
+		} else if (argv[i][0] != '-' && path.empty()) {
+			// read the program from a file instead of stdin.
+			path = argv[i];
+		} else {
+			std::cerr << "unknown flag '" << argv[i] << "'" << std::endl;
+			return 1;
+		}
+	}
+
+	std::unique_ptr<metrics::Exporter> exporter;
+	if (!metrics_out.empty()) {
+		exporter.reset(new metrics::Exporter(metrics::Registry::Default(), metrics_out, metrics_interval));
+		metrics::Exporter::WriteOnSignal(SIGUSR1);
+	}
 
-	auto lexf = std::async(std::launch::async, [](lexer::Lexer *lex, Channel<Token *> *chan){
-		Token *tok;
-		while ((tok = lex->Get()) != nullptr) {
-			// put item in channel
-			chan->Put(tok);
+	// modules are searched for next to the program first.
+	std::string dir = ".";
+	auto slash = path.rfind('/');
+	if (slash != std::string::npos) {
+		dir = slash == 0 ? "/" : path.substr(0, slash);
+	}
+	module_path.insert(module_path.begin(), dir);
+	ModuleLoader::Default()->set_search_path(module_path);
+	ModuleLoader::Default()->set_cache_dir(cache_dir);
+
+	std::string source;
+	Node *tree = nullptr;
+	Node::State e;
+	if (path.empty() && !socket_path.empty()) {
+		// a server without a prelude file starts from the builtins.
+		tree = new RootNode();
+	} else if (path.empty()) {
+		tree = parser::Parse(&std::cin, hash_cons);
+	} else {
+		std::ifstream in(path, std::ios::binary);
+		if (!in) {
+			std::cerr << "cannot read '" << path << "'" << std::endl;
+			return 1;
+		}
+		std::stringstream buf;
+		buf << in.rdbuf();
+		source = buf.str();
+		if (!cache_dir.empty()) {
+			tree = AstCache(cache_dir).Get(path, source, &e);
 		}
-		chan->Kill();
-	}, &lex, &chan);
+		if (tree == nullptr) {
+			std::istringstream is(source);
+			tree = parser::Parse(&is, hash_cons);
+			if (!cache_dir.empty()) {
+				AstCache(cache_dir).Put(path, source, tree);
+			}
+		}
+	}
 
-	auto parsef = std::async(std::launch::async, [](parser::Parser *p, Channel<Token *> *chan){
-		Token *tok;
-		while (chan->Get(&tok)) {
-			// put item in channel
-			p->Put(tok);
-			delete tok;
+	if (!image_in.empty()) {
+		Image *image = Image::Open(image_in);
+		if (image == nullptr) {
+			std::cerr << "cannot load image '" << image_in << "'" << std::endl;
+			return 1;
+		}
+		static_cast<GlobalScope *>(e.symbol_table())->set_fallback(new ImageScope(image, &e));
+	}
+	// macros are expanded before the optimizer sees the code they produce.
+	tree = Expander(&e).Run(tree);
+	if (optimize) {
+		Optimizer opt(&e);
+		tree = opt.Run(tree);
+		std::cerr << "optimize: " << opt.rewrites() << " rewrites" << std::endl;
+	}
+	if (profile || !profile_out.empty()) {
+		Profiler::Enable();
+	}
+	std::unique_ptr<Session> session;
+	if (live) {
+		session.reset(new Session(&e));
+		session->set_fuel(fuel, fuel_allocations);
+	}
+	Node *node = nullptr;
+	if (session != nullptr) {
+		// forms run one at a time so that what they read is recorded.
+		auto root = new RootNode();
+		for (auto& i: session->EvalAll(tree)) {
+			root->Put(i.value);
 		}
-	}, &p, &chan);
+		node = root;
+	} else if (fuel == 0 && fuel_allocations == 0) {
+		node = tree->Eval(&e);
+	} else {
+		MeteredEval eval(WorkerPool::Default(), tree, &e, fuel, fuel_allocations);
+		if (eval.Wait() == MeteredEval::kExhausted) {
+			std::cerr << "fuel exhausted after " << eval.meter().steps_used() << " steps" << std::endl;
+			eval.Cancel();
+			eval.Wait();
+		}
+		node = eval.result();
+	}
+	// script output comes before the results.
+	Output::Stdout()->Flush();
+	if (profile) {
+		Profiler::Report(&std::cerr);
+	}
+	if (!profile_out.empty()) {
+		std::ofstream out(profile_out);
+		Profiler::Collapsed(&out);
+		if (!out) {
+			std::cerr << "cannot write profile '" << profile_out << "'" << std::endl;
+			return 1;
+		}
+	}
 
-	// TODO:
-	// Third channel for trees of each statement.
-	// Lexer passes kPossibleBreak (newline and/or paren-cout is 0)
-	// Parser decides if it has a full statement (paren-count)
+	if (!socket_path.empty()) {
+		Server server(&e);
+		server.set_fuel(fuel, fuel_allocations);
+		server.set_session(session.get());
+		if (!server.Listen(socket_path)) {
+			std::cerr << "cannot listen on '" << socket_path << "'" << std::endl;
+			return 1;
+		}
+		server.Serve();
+		return 1;
+	}
 
-	lexf.wait();
-	parsef.wait();
+	// results are streamed, large structures are never
+	// printed into memory first.
+	Printer printer(&std::cout);
+	printer.set_max_depth(print_depth);
+	printer.set_max_length(print_length);
+	if (node != nullptr) {
+		std::cout << ">> ";
+		printer.Print(node);
+		std::cout << std::endl;
+	}
 
-	Node::State e;
-	Node *node = p.GetTree()->Eval(&e);
+	printer.PrintBindings(static_cast<GlobalScope *>(e.symbol_table())->Bindings());
 
-	if (node != nullptr) {
-		std::cout << ">> " << node->PPrint() << std::endl;
+	if (exporter != nullptr && !exporter->Flush()) {
+		std::cerr << "cannot write metrics '" << metrics_out << "'" << std::endl;
 	}
 
-	std::cout << e.symbol_table()->PPrint();
+	if (!image_out.empty()) {
+		ImageWriter w(&e);
+		w.AddGlobals();
+		if (!w.Write(image_out)) {
+			std::cerr << "cannot write image '" << image_out << "'" << std::endl;
+			return 1;
+		}
+		if (w.unsupported() > 0) {
+			std::cerr << "image: " << w.unsupported() << " values could not be saved" << std::endl;
+		}
+	}
 }
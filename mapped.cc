@@ -0,0 +1,78 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "mapped.h"
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace crisp {
+
+namespace {
+
+// files up to this size are copied rather than mapped.
+const std::size_t kCopyLimit = 64 * 1024;
+
+// reads n bytes of fd into a new buffer, or returns nullptr.
+char *ReadAll(int fd, std::size_t n) {
+	char *buf = new char[n];
+	for (std::size_t off = 0; off < n;) {
+		ssize_t r = read(fd, buf + off, n - off);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		} else if (r <= 0) {
+			// a file truncated since fstat is read as an error.
+			delete[] buf;
+			return nullptr;
+		}
+		off += r;
+	}
+	return buf;
+}
+
+} // namespace
+
+MappedFile *MappedFile::Open(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return nullptr;
+	}
+	if (st.st_size == 0) {
+		// empty files cannot be mapped.
+		close(fd);
+		return new MappedFile("", 0, false);
+	}
+	if (static_cast<std::size_t>(st.st_size) <= kCopyLimit) {
+		char *buf = ReadAll(fd, st.st_size);
+		close(fd);
+		return buf != nullptr ? new MappedFile(buf, st.st_size, false) : nullptr;
+	}
+	void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		return nullptr;
+	}
+	// the file is read front to back.
+	madvise(m, st.st_size, MADV_SEQUENTIAL);
+	return new MappedFile(static_cast<const char *>(m), st.st_size, true);
+}
+
+MappedFile::~MappedFile() {
+	if (mapped_) {
+		munmap(const_cast<char *>(data_), size_);
+	} else if (size_ > 0) {
+		delete[] data_;
+	}
+}
+
+} // namespace crisp
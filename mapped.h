@@ -0,0 +1,42 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_MAPPED_H_
+#define CRISP_MAPPED_H_
+
+#include "piece.h"
+
+#include <cstddef>
+#include <string>
+
+namespace crisp {
+
+// MappedFile is a read only memory mapping of a whole file.
+// small files are read into memory instead, they gain nothing from
+// a mapping. a mapped file truncated by another process while it is
+// mapped raises SIGBUS when the pages past its new end are touched,
+// files that may be changed while they are read must not be mapped.
+class MappedFile {
+public:
+	// returns the mapped file or nullptr if it cannot be mapped.
+	static MappedFile *Open(const std::string& path);
+	~MappedFile();
+
+	// deleted copy and move constructor.
+	MappedFile(const MappedFile&) = delete;
+	MappedFile(MappedFile&&) = delete;
+
+	// returns the contents, valid until the file is deleted.
+	StringPiece contents() const { return StringPiece(data_, size_); }
+private:
+	MappedFile(const char *data, std::size_t size, bool mapped) : data_(data), size_(size), mapped_(mapped) {}
+
+	const char *data_;
+	std::size_t size_;
+	bool mapped_;
+};
+
+} // namespace crisp
+
+#endif // CRISP_MAPPED_H_
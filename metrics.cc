@@ -0,0 +1,208 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "metrics.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace crisp {
+namespace metrics {
+
+namespace {
+
+thread_local Shard *local_shard = nullptr;
+
+// hands the shard back when its thread exits.
+struct ShardOwner {
+	Shard *shard = nullptr;
+	~ShardOwner() {
+		if (shard != nullptr) {
+			Registry::Default()->Release(shard);
+		}
+	}
+};
+
+// set by the signal handler, read by exporters.
+std::atomic<bool> signaled = {false};
+
+void OnSignal(int) {
+	signaled.store(true, std::memory_order_relaxed);
+}
+
+} // namespace
+
+Shard *LocalShard() {
+	if (local_shard == nullptr) {
+		static thread_local ShardOwner owner;
+		owner.shard = local_shard = Registry::Default()->Acquire();
+	}
+	return local_shard;
+}
+
+Registry *Registry::Default() {
+	static Registry *r = new Registry();
+	return r;
+}
+
+std::size_t Registry::Register(Metric *m, std::size_t n) {
+	std::lock_guard<std::mutex> lock(mut);
+	if (used + n > Shard::kSlots) {
+		// metrics are registered at startup, so this is a build
+		// that outgrew the shards rather than a runtime condition.
+		fprintf(stderr, "metrics: no slots left for %s, %zu of %zu used\n",
+			m->name().c_str(), used, Shard::kSlots);
+		abort();
+	}
+	metrics.push_back(m);
+	used += n;
+	return used - n;
+}
+
+uint64_t Registry::Sum(std::size_t slot) {
+	uint64_t sum = 0;
+	std::lock_guard<std::mutex> lock(mut);
+	for (auto s: shards) {
+		sum += s->slots[slot].load(std::memory_order_relaxed);
+	}
+	return sum;
+}
+
+Shard *Registry::Acquire() {
+	std::lock_guard<std::mutex> lock(mut);
+	if (!free.empty()) {
+		Shard *s = free.back();
+		free.pop_back();
+		return s;
+	}
+	Shard *s = new Shard();
+	for (auto& i: s->slots) {
+		i.store(0, std::memory_order_relaxed);
+	}
+	shards.push_back(s);
+	return s;
+}
+
+void Registry::Release(Shard *s) {
+	std::lock_guard<std::mutex> lock(mut);
+	free.push_back(s);
+}
+
+void Registry::Write(std::ostream *os) {
+	std::multimap<std::string, Metric *> sorted;
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		for (auto m: metrics) {
+			sorted.emplace(m->name(), m);
+		}
+	}
+	const std::string *last = nullptr;
+	for (auto& i: sorted) {
+		// metrics sharing a name are one family.
+		if (last == nullptr || *last != i.first) {
+			*os << "# HELP " << i.first << " " << i.second->help() << "\n";
+			*os << "# TYPE " << i.first << " " << i.second->type() << "\n";
+		}
+		i.second->Write(this, os);
+		last = &i.first;
+	}
+}
+
+std::string Metric::Sample(const std::string& suffix, const std::string& extra) const {
+	std::string labels = labels_;
+	if (!extra.empty()) {
+		labels += labels.empty() ? extra : "," + extra;
+	}
+	return name_ + suffix + (labels.empty() ? "" : "{" + labels + "}");
+}
+
+Counter::Counter(const std::string& name, const std::string& help, const std::string& labels)
+	: Metric(name, help, labels) {
+	slot = Registry::Default()->Register(this, 1);
+}
+
+void Counter::Write(Registry *r, std::ostream *os) const {
+	*os << Sample("", "") << " " << r->Sum(slot) << "\n";
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, std::vector<uint64_t> b, double s, const std::string& labels)
+	: Metric(name, help, labels), bounds(b), scale(s) {
+	// a bucket per bound, the +Inf bucket and the sum.
+	slot = Registry::Default()->Register(this, bounds.size() + 2);
+}
+
+void Histogram::Write(Registry *r, std::ostream *os) const {
+	// buckets are recorded separately and written cumulatively.
+	uint64_t count = 0;
+	for (std::size_t i = 0; i <= bounds.size(); i++) {
+		count += r->Sum(slot + i);
+		std::ostringstream le;
+		le.precision(12);
+		if (i < bounds.size()) {
+			le << "le=\"" << bounds[i] * scale << "\"";
+		} else {
+			le << "le=\"+Inf\"";
+		}
+		*os << Sample("_bucket", le.str()) << " " << count << "\n";
+	}
+	*os << Sample("_sum", "") << " " << r->Sum(slot + bounds.size() + 1) * scale << "\n";
+	*os << Sample("_count", "") << " " << count << "\n";
+}
+
+std::vector<uint64_t> Histogram::Exponential(uint64_t first, uint64_t factor, std::size_t n) {
+	std::vector<uint64_t> bounds;
+	for (uint64_t b = first; bounds.size() < n; b *= factor) {
+		bounds.push_back(b);
+	}
+	return bounds;
+}
+
+Exporter::Exporter(Registry *r, const std::string& p, int i) : registry(r), path(p), interval(i) {
+	registry->Enable();
+	thread = std::thread(&Exporter::Loop, this);
+}
+
+Exporter::~Exporter() {
+	done.store(true);
+	thread.join();
+}
+
+bool Exporter::Flush() {
+	std::lock_guard<std::mutex> lock(flush_mut);
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp);
+		registry->Write(&out);
+		if (!out) {
+			return false;
+		}
+	}
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+void Exporter::WriteOnSignal(int sig) {
+	std::signal(sig, OnSignal);
+}
+
+void Exporter::Loop() {
+	// polls so that the signal handler only has to set a flag.
+	const auto tick = std::chrono::milliseconds(100);
+	auto next = std::chrono::steady_clock::now() + std::chrono::seconds(interval);
+	while (!done.load()) {
+		std::this_thread::sleep_for(tick);
+		bool due = interval > 0 && std::chrono::steady_clock::now() >= next;
+		if (signaled.exchange(false) || due) {
+			Flush();
+			next = std::chrono::steady_clock::now() + std::chrono::seconds(interval);
+		}
+	}
+}
+
+} // namespace metrics
+} // namespace crisp
@@ -0,0 +1,163 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_METRICS_H_
+#define CRISP_METRICS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace crisp {
+namespace metrics {
+
+// values of every metric as recorded by one thread. a shard is only
+// written by its owner, so recording is a plain load and store.
+// shards of exited threads are reused, their values are kept.
+struct Shard {
+	static const std::size_t kSlots = 512;
+	std::atomic<uint64_t> slots[kSlots];
+};
+
+// returns the calling thread's shard.
+Shard *LocalShard();
+
+inline void Add(std::size_t slot, uint64_t n) {
+	std::atomic<uint64_t>& v = LocalShard()->slots[slot];
+	v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class Metric;
+
+// Registry owns the shards and the metrics recorded into them.
+class Registry {
+public:
+	// returns the process wide registry.
+	static Registry *Default();
+
+	// writes every metric in the Prometheus text format.
+	void Write(std::ostream *os);
+
+	// adds a metric needing n slots, returns its first slot.
+	// running out of slots aborts, raise Shard::kSlots instead.
+	std::size_t Register(Metric *m, std::size_t n);
+
+	// whether anything reads the metrics. counting is always on, but
+	// measurements that cost more than a count, such as reading the
+	// clock, are only taken once enabled.
+	void Enable() { enabled_.store(true, std::memory_order_relaxed); }
+	bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+	// returns slot summed over every shard.
+	uint64_t Sum(std::size_t slot);
+
+	// returns a shard for a new thread.
+	Shard *Acquire();
+	// returns the shard of an exiting thread.
+	void Release(Shard *s);
+private:
+	std::mutex mut;
+	std::vector<Metric *> metrics;
+	std::vector<Shard *> shards;
+	std::vector<Shard *> free;
+	std::size_t used = 0;
+	std::atomic<bool> enabled_ = {false};
+};
+
+class Metric {
+public:
+	// labels are written as is between braces, as in `type="list"`.
+	// metrics may share a name if their labels differ.
+	Metric(const std::string& name, const std::string& help, const std::string& labels)
+		: name_(name), help_(help), labels_(labels) {}
+	virtual ~Metric() {}
+
+	virtual const char *type() const = 0;
+	// writes the samples of this metric.
+	virtual void Write(Registry *r, std::ostream *os) const = 0;
+
+	const std::string& name() const { return name_; }
+	const std::string& help() const { return help_; }
+protected:
+	// returns name with labels, extra labels appended to them.
+	std::string Sample(const std::string& suffix, const std::string& extra) const;
+private:
+	std::string name_, help_, labels_;
+};
+
+// Counter is a monotonically increasing count.
+class Counter : public Metric {
+public:
+	Counter(const std::string& name, const std::string& help, const std::string& labels = "");
+	void Inc(uint64_t n = 1) { Add(slot, n); }
+	virtual const char *type() const { return "counter"; }
+	virtual void Write(Registry *r, std::ostream *os) const;
+private:
+	std::size_t slot;
+};
+
+// Histogram counts observations into buckets of upper bounds.
+// observations are integers, written multiplied by scale,
+// for example nanoseconds with a scale of 1e-9 are written as seconds.
+class Histogram : public Metric {
+public:
+	Histogram(const std::string& name, const std::string& help, std::vector<uint64_t> bounds, double scale = 1, const std::string& labels = "");
+	void Observe(uint64_t v) {
+		std::size_t i = 0;
+		while (i < bounds.size() && v > bounds[i]) {
+			i++;
+		}
+		Add(slot + i, 1);
+		Add(slot + bounds.size() + 1, v);
+	}
+	virtual const char *type() const { return "histogram"; }
+	virtual void Write(Registry *r, std::ostream *os) const;
+
+	// returns bounds growing by factor from first.
+	static std::vector<uint64_t> Exponential(uint64_t first, uint64_t factor, std::size_t n);
+private:
+	std::vector<uint64_t> bounds;
+	double scale;
+	std::size_t slot;
+};
+
+// Exporter writes a registry to a file every interval seconds,
+// and whenever the signal installed by WriteOnSignal arrives.
+// it enables the registry.
+// the file is replaced whole, readers never see a partial write.
+class Exporter {
+public:
+	Exporter(Registry *r, const std::string& path, int interval);
+	~Exporter();
+
+	// deleted copy and move constructor.
+	Exporter(const Exporter&) = delete;
+	Exporter(Exporter&&) = delete;
+
+	// writes the metrics now, returns false if the file could not be written.
+	// flushes are serialized, they share a temporary file.
+	bool Flush();
+
+	// makes sig request a write from every exporter.
+	static void WriteOnSignal(int sig);
+private:
+	void Loop();
+
+	Registry *registry;
+	std::string path;
+	int interval;
+	std::atomic<bool> done = {false};
+	std::mutex flush_mut;
+	std::thread thread;
+};
+
+} // namespace metrics
+} // namespace crisp
+
+#endif // CRISP_METRICS_H_
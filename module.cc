@@ -0,0 +1,195 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "module.h"
+#include "astcache.h"
+#include "expand.h"
+#include "heap.h"
+#include "metrics.h"
+#include "parser.h"
+
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+namespace crisp {
+
+namespace {
+
+const char kLoadedHelp[] = "Modules loaded, by where their tree came from.";
+metrics::Counter parsed_modules("crisp_modules_loaded_total", kLoadedHelp, "source=\"parse\"");
+metrics::Counter cached_modules("crisp_modules_loaded_total", kLoadedHelp, "source=\"cache\"");
+
+bool IsFile(const std::string& path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// guards the state of every module and the loads waiting on them,
+// so a wait is only added after checking it closes no cycle.
+std::mutex load_mut;
+// the module each waiting fiber or thread waits for.
+std::map<const void *, const ModuleNode *> waiting;
+
+thread_local char thread_loader;
+
+// returns what identifies the calling load, its fiber, which may move
+// between threads, or else its thread.
+const void *CurrentLoader() {
+	Fiber *f = Fiber::Current();
+	return f != nullptr ? static_cast<const void *>(f) : &thread_loader;
+}
+
+} // namespace
+
+ModuleNode::ModuleNode(std::string name, std::string path, std::string cache_dir)
+	: name_(name), path_(path), cache_dir_(cache_dir) {}
+
+Node *ModuleNode::Eval(State *state) const {
+	return const_cast<ModuleNode *>(this); // modules evaluate to themselves
+}
+
+std::string ModuleNode::PPrint() const {
+	return "{module " + name_ + (loaded() ? "}" : " unloaded}");
+}
+
+bool ModuleNode::loaded() const {
+	std::lock_guard<std::mutex> lock(load_mut);
+	return loaded_;
+}
+
+bool ModuleNode::Cyclic(const void *loader) const {
+	// each load waits for at most one module, so the loads
+	// waiting on this one form a chain, at most all of them long.
+	const ModuleNode *m = this;
+	for (std::size_t i = 0; i <= waiting.size(); i++) {
+		if (m->loader_ == loader) {
+			return true;
+		}
+		auto w = waiting.find(m->loader_);
+		if (w == waiting.end()) {
+			return false;
+		}
+		m = w->second;
+	}
+	return false;
+}
+
+void ModuleNode::Load(Node::State *state) {
+	std::ifstream in(path_, std::ios::binary);
+	std::stringstream buf;
+	buf << in.rdbuf();
+	std::string source = buf.str();
+
+	Node *tree = nullptr;
+	if (!cache_dir_.empty()) {
+		tree = AstCache(cache_dir_).Get(path_, source, state);
+	}
+	if (tree != nullptr) {
+		cached_modules.Inc();
+	} else {
+		std::istringstream is(source);
+		tree = parser::Parse(&is, false);
+		if (!cache_dir_.empty()) {
+			AstCache(cache_dir_).Put(path_, source, tree);
+		}
+		parsed_modules.Inc();
+	}
+	Expander(state).Run(tree)->Eval(state);
+}
+
+Node *ModuleNode::Get(const std::string& symbol) {
+	std::unique_lock<std::mutex> lock(load_mut);
+	const void *self = CurrentLoader();
+	if (state_ == nullptr) {
+		// modules outlive the isolate that first uses them.
+		Heap::Use global(nullptr);
+		state_ = new Node::State(new GlobalScope());
+		state_->RegisterBuiltins();
+		loader_ = self;
+		lock.unlock();
+		Load(state_);
+		lock.lock();
+		loaded_ = true;
+		loader_ = nullptr;
+		for (auto& w: waiters_) {
+			w->Wake();
+		}
+		waiters_.clear();
+	} else if (!loaded_ && !Cyclic(self)) {
+		auto w = std::make_shared<Waiter>();
+		waiters_.push_back(w);
+		waiting[self] = this;
+		lock.unlock();
+		w->Wait();
+		lock.lock();
+		waiting.erase(self);
+	}
+	Node::State *state = state_;
+	lock.unlock();
+
+	Node *def = state->symbol_table()->Get(symbol);
+	if (def == nullptr) {
+		return new ErrorNode("module '" + name_ + "' has no symbol '" + symbol + "'");
+	}
+	// definitions are evaluated in the module's namespace.
+	return def->Eval(state);
+}
+
+ModuleLoader *ModuleLoader::Default() {
+	static ModuleLoader *loader = new ModuleLoader();
+	return loader;
+}
+
+void ModuleLoader::set_search_path(std::vector<std::string> dirs) {
+	std::lock_guard<std::mutex> lock(mut);
+	search_path = dirs;
+}
+
+void ModuleLoader::set_cache_dir(std::string dir) {
+	std::lock_guard<std::mutex> lock(mut);
+	cache_dir = dir;
+}
+
+ModuleNode *ModuleLoader::Resolve(const std::string& name) {
+	std::string file = name;
+	for (auto& c: file) {
+		if (c == '.') {
+			c = '/';
+		}
+	}
+	file += ".crisp";
+
+	std::lock_guard<std::mutex> lock(mut);
+	for (auto& dir: search_path) {
+		std::string path = dir + "/" + file;
+		if (!IsFile(path)) {
+			continue;
+		}
+		auto i = modules.find(path);
+		if (i != modules.end()) {
+			return i->second;
+		}
+		Heap::Use global(nullptr);
+		auto module = new ModuleNode(name, path, cache_dir);
+		modules[path] = module;
+		return module;
+	}
+	return nullptr;
+}
+
+Node *LookupQualified(Node::State *state, const std::string& id) {
+	auto slash = id.rfind('/');
+	if (slash == std::string::npos || slash == 0 || slash + 1 == id.size()) {
+		return nullptr;
+	}
+	auto module = dynamic_cast<ModuleNode *>(state->symbol_table()->Get(id.substr(0, slash)));
+	if (module == nullptr) {
+		return nullptr;
+	}
+	return module->Get(id.substr(slash + 1));
+}
+
+} // namespace crisp
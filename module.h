@@ -0,0 +1,91 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_MODULE_H_
+#define CRISP_MODULE_H_
+
+#include "tree.h"
+#include "fiber.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace crisp {
+
+// ModuleNode is a source file with a namespace of its own.
+// it is loaded, that is parsed and evaluated in its own global
+// scope, when one of its symbols is first looked up, so requiring
+// a module costs nothing until it is used.
+// a lookup in a module being loaded elsewhere waits for it, parking
+// if on a fiber, unless the wait would close a cycle of loads waiting
+// on each other. the lookup then sees what is defined so far.
+// it evaluates to itself.
+class ModuleNode : public Node {
+public:
+	ModuleNode(std::string name, std::string path, std::string cache_dir);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+
+	// returns the value of symbol in the module, loading it first
+	// if needed, or an ErrorNode if it has no such symbol.
+	Node *Get(const std::string& symbol);
+
+	const std::string& path() const { return path_; }
+	bool loaded() const;
+private:
+	// parses and evaluates the module's source in state.
+	void Load(Node::State *state);
+
+	// returns true if waiting for this module on behalf of loader
+	// would wait on loader itself, the load mutex must be held.
+	bool Cyclic(const void *loader) const;
+
+	std::string name_;
+	std::string path_;
+	std::string cache_dir_;
+
+	// the rest is guarded by the load mutex shared by all modules.
+	// the namespace exists from the start of loading, so modules
+	// that require each other see what is defined so far.
+	Node::State *state_ = nullptr;
+	// the fiber or thread loading the module.
+	const void *loader_ = nullptr;
+	std::vector<std::shared_ptr<Waiter>> waiters_;
+	bool loaded_ = false;
+};
+
+// ModuleLoader resolves module names to files and keeps one
+// ModuleNode per file, so every require of a file shares its
+// namespace. a name such as lib.strings is the file lib/strings.crisp
+// in the first directory of the search path that has it.
+class ModuleLoader {
+public:
+	// returns the process wide loader.
+	static ModuleLoader *Default();
+
+	// directories searched for modules, in order.
+	void set_search_path(std::vector<std::string> dirs);
+
+	// directory compiled modules are cached in, empty for none.
+	void set_cache_dir(std::string dir);
+
+	// returns the module name resolves to, or nullptr if no file does.
+	ModuleNode *Resolve(const std::string& name);
+private:
+	std::mutex mut;
+	std::vector<std::string> search_path = {"."};
+	std::string cache_dir;
+	std::map<std::string, ModuleNode *> modules;
+};
+
+// returns the value a qualified identifier, module/symbol, names
+// through a module bound in state, or nullptr if it names none.
+Node *LookupQualified(Node::State *state, const std::string& id);
+
+} // namespace crisp
+
+#endif // CRISP_MODULE_H_
@@ -0,0 +1,235 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "optimize.h"
+#include "functions.h"
+
+namespace crisp {
+
+Node *Optimizer::Run(Node *node) {
+	auto root = dynamic_cast<ParentNode *>(node);
+	if (root == nullptr) {
+		return node;
+	}
+
+	Scan(node);
+	if (Shadowed("def") || Shadowed("lambda") || Shadowed("quote")) {
+		// without the special forms nothing is known about the program.
+		return node;
+	}
+
+	ParentNode *out = new RootNode();
+	for (auto i: root->children()) {
+		out->Put(Rewrite(i));
+
+		// constants defined once may be inlined into the following forms.
+		auto l = dynamic_cast<ListNode *>(i);
+		if (l != nullptr && l->children().size() == 3 && IsForm(l->children()[0], "def")) {
+			auto id = dynamic_cast<IdentNode *>(l->children()[1]);
+			if (id != nullptr && defs[id->str()] == 1 && params.count(id->str()) == 0) {
+				// the def itself is kept as written, so rewrites
+				// of its value are not counted.
+				int count = rewrites_;
+				Node *c = Constant(Rewrite(l->children()[2]));
+				rewrites_ = count;
+				if (c != nullptr) {
+					constants[id->str()] = c;
+				}
+			}
+		}
+	}
+	return out;
+}
+
+void Optimizer::Scan(Node *node) {
+	auto l = dynamic_cast<ParentNode *>(node);
+	if (l == nullptr) {
+		return;
+	}
+	auto& c = l->children();
+	if (c.size() >= 2) {
+		auto head = dynamic_cast<IdentNode *>(c[0]);
+		auto id = dynamic_cast<IdentNode *>(c[1]);
+		if (head != nullptr && id != nullptr) {
+			if (head->str() == "def") {
+				defs[id->str()]++;
+			} else if (head->str() == "lambda") {
+				params.insert(id->str());
+			}
+		}
+	}
+	for (auto i: c) {
+		Scan(i);
+	}
+}
+
+bool Optimizer::Shadowed(const std::string& id) const {
+	return defs.count(id) != 0 || params.count(id) != 0;
+}
+
+bool Optimizer::IsForm(Node *node, const std::string& id) const {
+	auto i = dynamic_cast<IdentNode *>(node);
+	return i != nullptr && i->str() == id && !Shadowed(id);
+}
+
+Node *Optimizer::Constant(Node *node) const {
+	if (dynamic_cast<NumNode *>(node) != nullptr
+		|| dynamic_cast<StringNode *>(node) != nullptr
+		|| dynamic_cast<BooleanNode *>(node) != nullptr) {
+		return node;
+	}
+	auto id = dynamic_cast<IdentNode *>(node);
+	if (id != nullptr && !Shadowed(id->str())) {
+		// builtin constants such as #t.
+		Node *n = state->symbol_table()->Get(id->str());
+		if (dynamic_cast<BooleanNode *>(n) != nullptr) {
+			return n;
+		}
+	}
+	return nullptr;
+}
+
+Node *Optimizer::Rewrite(Node *node) {
+	auto id = dynamic_cast<IdentNode *>(node);
+	if (id != nullptr) {
+		auto i = constants.find(id->str());
+		if (i != constants.end()) {
+			rewrites_++;
+			return i->second;
+		}
+		return node;
+	}
+
+	auto l = dynamic_cast<ListNode *>(node);
+	if (l == nullptr || l->children().empty()) {
+		return node;
+	}
+	auto& c = l->children();
+	if (IsForm(c[0], "quote") || IsForm(c[0], "def")) {
+		return node;
+	}
+
+	std::vector<Node *> out;
+	if (IsForm(c[0], "lambda")) {
+		// only the body of a lambda is an expression.
+		out = c;
+		if (out.size() == 3) {
+			out[2] = Rewrite(out[2]);
+		}
+	} else {
+		for (auto i: c) {
+			out.push_back(Rewrite(i));
+		}
+	}
+
+	if (Node *n = Reduce(out)) {
+		rewrites_++;
+		return Rewrite(n);
+	}
+	if (Node *n = Fold(out)) {
+		rewrites_++;
+		return n;
+	}
+	if (out == c) {
+		return node;
+	}
+	auto list = new ListNode();
+	for (auto i: out) {
+		list->Put(i);
+	}
+	return list;
+}
+
+Node *Optimizer::Fold(const std::vector<Node *>& list) {
+	auto id = dynamic_cast<IdentNode *>(list[0]);
+	if (id == nullptr || Shadowed(id->str())) {
+		return nullptr;
+	}
+	auto f = dynamic_cast<CallNode *>(state->symbol_table()->Get(id->str()));
+	if (f == nullptr || !f->Pure()) {
+		return nullptr;
+	}
+	std::vector<Node *> args;
+	for (auto i = list.begin() + 1; i != list.end(); i++) {
+		Node *c = Constant(*i);
+		if (c == nullptr) {
+			return nullptr;
+		}
+		args.push_back(c);
+	}
+	// errors are left to be reported at run time.
+	return Constant(f->Call(state, args));
+}
+
+Node *Optimizer::Reduce(const std::vector<Node *>& list) {
+	if (list.size() != 2) {
+		return nullptr;
+	}
+	auto lambda = dynamic_cast<ListNode *>(list[0]);
+	if (lambda == nullptr || lambda->children().size() != 3 || !IsForm(lambda->children()[0], "lambda")) {
+		return nullptr;
+	}
+	auto param = dynamic_cast<IdentNode *>(lambda->children()[1]);
+	Node *arg = Constant(list[1]);
+	if (param == nullptr || arg == nullptr) {
+		return nullptr;
+	}
+	bool ok = true;
+	Node *body = Substitute(lambda->children()[2], param->str(), arg, &ok);
+	return ok ? body : nullptr;
+}
+
+Node *Optimizer::Substitute(Node *body, const std::string& param, Node *arg, bool *ok) const {
+	auto id = dynamic_cast<IdentNode *>(body);
+	if (id != nullptr) {
+		if (id->str() == param) {
+			return arg;
+		}
+		// the body moves out of the lambda's scope, which
+		// is only safe if no other lambda could bind the name.
+		if (params.count(id->str()) != 0) {
+			*ok = false;
+		}
+		return body;
+	}
+
+	auto l = dynamic_cast<ListNode *>(body);
+	if (l == nullptr || l->children().empty()) {
+		return body;
+	}
+	auto& c = l->children();
+	if (IsForm(c[0], "quote")) {
+		return body;
+	}
+	if (IsForm(c[0], "def")) {
+		// the value is evaluated wherever the name is used.
+		*ok = false;
+		return body;
+	}
+	std::size_t first = 0;
+	if (IsForm(c[0], "lambda")) {
+		auto id = c.size() == 3 ? dynamic_cast<IdentNode *>(c[1]) : nullptr;
+		if (id == nullptr || id->str() == param) {
+			// the inner lambda's parameter shadows this one.
+			return body;
+		}
+		first = 2;
+	}
+	// arguments are evaluated in the caller's scope,
+	// so they are substituted along with the callee.
+	std::vector<Node *> out = c;
+	for (std::size_t i = first; i < out.size(); i++) {
+		out[i] = Substitute(out[i], param, arg, ok);
+	}
+	if (out == c) {
+		return body;
+	}
+	auto list = new ListNode();
+	for (auto i: out) {
+		list->Put(i);
+	}
+	return list;
+}
+
+} // namespace crisp
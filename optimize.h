@@ -0,0 +1,62 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_OPTIMIZE_H_
+#define CRISP_OPTIMIZE_H_
+
+#include "tree.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+namespace crisp {
+
+// Optimizer rewrites a parsed tree before evaluation.
+// It folds calls to pure builtins whose arguments are constants,
+// inlines constants bound once by a top level def, and beta-reduces
+// lambdas applied to a constant.
+//
+// Lambda parameters and builtins are resolved dynamically, so any name
+// that is bound as a parameter or by def anywhere in the program is
+// left alone. def forms are never rewritten, so the symbol table holds
+// exactly what was written.
+class Optimizer {
+public:
+	Optimizer(Node::State *s) : state(s) {}
+
+	// returns an optimized copy of root, root itself is not modified.
+	Node *Run(Node *root);
+
+	// returns the number of rewrites made by Run.
+	int rewrites() const { return rewrites_; }
+private:
+	// records the names bound by def and lambda under node.
+	void Scan(Node *node);
+
+	Node *Rewrite(Node *node);
+
+	// returns the constant node evaluates to, or nullptr if it is not constant.
+	Node *Constant(Node *node) const;
+
+	// returns true if id names a special form which has not been rebound.
+	bool IsForm(Node *node, const std::string& id) const;
+	bool Shadowed(const std::string& id) const;
+
+	Node *Fold(const std::vector<Node *>& list);
+	Node *Reduce(const std::vector<Node *>& list);
+
+	// replaces param in the positions of body evaluated in the lambda's scope.
+	Node *Substitute(Node *body, const std::string& param, Node *arg, bool *ok) const;
+
+	Node::State *state;
+	std::map<std::string, int> defs;
+	std::set<std::string> params;
+	std::map<std::string, Node *> constants;
+	int rewrites_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_OPTIMIZE_H_
@@ -1,13 +1,55 @@
 
 #include "parser.h"
+#include "lexer.h"
+#include "channel.h"
+#include "metrics.h"
+#include "heap.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <future>
 
 namespace crisp {
 namespace parser {
 
+namespace {
+
+metrics::Counter tokens_lexed("crisp_lexer_tokens_total", "Tokens produced by the lexer.");
+metrics::Counter lists_parsed("crisp_parser_lists_total", "Lists completed by the parser.");
+metrics::Histogram parse_latency("crisp_parse_seconds", "Time to lex and parse each input.",
+	metrics::Histogram::Exponential(10000, 4, 12), 1e-9);
+
+} // namespace
+
 Parser::Parser() {
 	path.push_back(new RootNode());
 }
 
+Parser::Parser(bool hash_cons) : Parser() {
+	if (hash_cons) {
+		interner_ = new Interner();
+	}
+}
+
+Parser::~Parser() {
+	delete interner_;
+}
+
+void Parser::Close() {
+	lists_parsed.Inc();
+	Node *list = path.back();
+	path.pop_back();
+	if (interner_ != nullptr) {
+		// the list is complete, so it may be shared.
+		Node *canon = interner_->Intern(list);
+		if (canon != list) {
+			static_cast<ParentNode *>(path.back())->ReplaceLast(canon);
+		}
+	}
+}
+
 void Parser::Put(Token *tok) {
 	// begginning of list.
 	if (tok->category() == Token::kBeginParen) {
@@ -24,24 +66,30 @@ void Parser::Put(Token *tok) {
 				std::cout << "unmatched paren!" << std::endl;
 			}
 		} else {
-			path.pop_back(); // ascend tree
+			Close(); // ascend tree
 		}
 	} else if (tok->category() == Token::kEndAllParen) {
 		paren_count = 0;
-		Node *node = path.front();
-		path.clear();
-		path.push_back(node);
+		while (path.size() > 1) {
+			Close();
+		}
 	} else if (tok->category() == Token::kComment) {
 		// throw away comment.
 	} else if (tok->category() == Token::kError) {
 		// print error, attempt recovery (via ignoring).
 		std::cout << ErrorNode(tok->lexeme()).PPrint();
 	} else {
-		static_cast<ParentNode *>(path.back())->Put([&]()->Node* {
+		Node *node = [&]()->Node* {
 			if (tok->category() == Token::kIdent) {
 				return new IdentNode(tok->lexeme());
 			} else if (tok->category() == Token::kNum) {
-				return new NumNode(std::stoi(tok->lexeme()));
+				// stoi would throw on the parsing thread and hang the parse.
+				errno = 0;
+				long n = strtol(tok->lexeme().c_str(), nullptr, 10);
+				if (errno == ERANGE || n > INT_MAX || n < INT_MIN) {
+					return new ErrorNode("number out of range '" + tok->lexeme() + "'");
+				}
+				return new NumNode(n);
 			} else if (tok->category() == Token::kString) {
 				return new StringNode(tok->lexeme());
 			} else {
@@ -49,9 +97,55 @@ void Parser::Put(Token *tok) {
 				s << "Unknown token type '" << tok->str() << "'";
 				return new ErrorNode(s.str());
 			}
-		}());
+		}();
+		if (interner_ != nullptr && dynamic_cast<ErrorNode *>(node) == nullptr) {
+			node = interner_->Intern(node);
+		}
+		static_cast<ParentNode *>(path.back())->Put(node);
 	}
 }
 
+// lexes and parses in on two threads, returning the tree.
+Node *Parse(std::istream *in, bool hash_cons) {
+	auto start = std::chrono::steady_clock::now();
+	InputScanner scanner(in);
+	lexer::Lexer lex(&scanner);
+	parser::Parser p(hash_cons);
+	Channel<Token *> chan(5);
+
+	auto lexf = std::async(std::launch::async, [](lexer::Lexer *lex, Channel<Token *> *chan){
+		Token *tok;
+		while ((tok = lex->Get()) != nullptr) {
+			// put item in channel
+			tokens_lexed.Inc();
+			chan->Put(tok);
+		}
+		chan->Kill();
+	}, &lex, &chan);
+
+	// the tree is allocated from the caller's heap.
+	auto parsef = std::async(std::launch::async, [](parser::Parser *p, Channel<Token *> *chan, Heap *heap){
+		Heap::Use use(heap);
+		Token *tok;
+		while (chan->Get(&tok)) {
+			// put item in channel
+			p->Put(tok);
+			delete tok;
+		}
+	}, &p, &chan, Heap::Current());
+
+	// TODO:
+	// Third channel for trees of each statement.
+	// Lexer passes kPossibleBreak (newline and/or paren-cout is 0)
+	// Parser decides if it has a full statement (paren-count)
+
+	lexf.wait();
+	parsef.wait();
+
+	parse_latency.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count());
+	return p.GetTree();
+}
+
 } // namespace parser
 } // namespace crisp
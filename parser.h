@@ -3,6 +3,7 @@
 #define CRISP_PARSER_H_
 
 #include "tree.h"
+#include "intern.h"
 
 #include <vector>
 
@@ -17,17 +18,30 @@ namespace parser {
 class Parser {
 public:
 	Parser();
+	// if hash_cons is true, structurally equal atoms and
+	// lists share a single node.
+	Parser(bool hash_cons);
+	~Parser();
 	void Put(Token *tok);
 	Node *GetTree() const {
 		return path.empty() ? nullptr : path[0];
 	}
+	Interner *interner() const { return interner_; }
 private:
+	// ascends from the current list.
+	void Close();
+
+	Interner *interner_ = nullptr;
+
 	// path to current node.
 	int const_count = 0;
 	int paren_count = 0;
 	std::vector<Node *> path;
 };
 
+// lexes and parses in on two threads, returning the tree.
+Node *Parse(std::istream *in, bool hash_cons);
+
 } // namespace parser
 } // namespace crisp
 
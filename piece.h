@@ -0,0 +1,77 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_PIECE_H_
+#define CRISP_PIECE_H_
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace crisp {
+
+// StringPiece is a view of characters owned elsewhere,
+// it is only valid while they are.
+class StringPiece {
+public:
+	StringPiece() : data_(nullptr), size_(0) {}
+	StringPiece(const char *data, std::size_t size) : data_(data), size_(size) {}
+	StringPiece(const char *str) : data_(str), size_(std::strlen(str)) {}
+	StringPiece(const std::string& str) : data_(str.data()), size_(str.size()) {}
+
+	const char *data() const { return data_; }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	const char *begin() const { return data_; }
+	const char *end() const { return data_ + size_; }
+	char operator[](std::size_t i) const { return data_[i]; }
+
+	// returns up to n characters from pos.
+	StringPiece substr(std::size_t pos, std::size_t n = std::string::npos) const {
+		if (pos > size_) {
+			pos = size_;
+		}
+		if (n > size_ - pos) {
+			n = size_ - pos;
+		}
+		return StringPiece(data_ + pos, n);
+	}
+
+	// returns a negative, zero or positive number as this
+	// orders before, with or after other.
+	int compare(const StringPiece& other) const {
+		std::size_t n = size_ < other.size_ ? size_ : other.size_;
+		int c = n == 0 ? 0 : std::memcmp(data_, other.data_, n);
+		if (c != 0) {
+			return c;
+		}
+		return size_ < other.size_ ? -1 : (size_ > other.size_ ? 1 : 0);
+	}
+
+	std::string ToString() const { return std::string(data_, size_); }
+private:
+	const char *data_;
+	std::size_t size_;
+};
+
+inline bool operator==(const StringPiece& a, const StringPiece& b) {
+	return a.size() == b.size() && a.compare(b) == 0;
+}
+
+inline bool operator!=(const StringPiece& a, const StringPiece& b) {
+	return !(a == b);
+}
+
+inline bool operator<(const StringPiece& a, const StringPiece& b) {
+	return a.compare(b) < 0;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const StringPiece& p) {
+	return os.write(p.data(), p.size());
+}
+
+} // namespace crisp
+
+#endif // CRISP_PIECE_H_
@@ -0,0 +1,179 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "pool.h"
+#include "heap.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace crisp {
+
+namespace {
+
+// the pool and index of the worker running on this thread.
+thread_local WorkerPool *current_pool = nullptr;
+thread_local int current_worker = -1;
+
+const std::chrono::milliseconds kHelpTimeout(10);
+
+} // namespace
+
+WorkerPool::WorkerPool(int n) : alive_(true) {
+	n = std::max(n, 1);
+	for (int i = 0; i < n; i++) {
+		workers.push_back(new Worker());
+	}
+	for (int i = 0; i < n; i++) {
+		threads.emplace_back(&WorkerPool::Loop, this, i);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		alive_ = false;
+	}
+	wake.notify_all();
+	for (auto& i: threads) {
+		i.join();
+	}
+	for (auto i: workers) {
+		delete i;
+	}
+}
+
+WorkerPool *WorkerPool::Default() {
+	// never destroyed, tasks may outlive main.
+	static WorkerPool *pool = new WorkerPool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+int WorkerPool::Self() const {
+	return current_pool == this ? current_worker : -1;
+}
+
+void WorkerPool::Submit(Task task) {
+	int self = Self();
+	Worker *w = workers[self >= 0 ? self : next_++ % workers.size()];
+	{
+		Heap *heap = Heap::Current();
+		if (heap != nullptr) {
+			heap->Pin();
+		}
+		std::lock_guard<std::mutex> lock(w->mut);
+		w->tasks.push_back(Job{std::move(task), heap});
+	}
+	{
+		std::lock_guard<std::mutex> lock(mut);
+		queued_++;
+		if (helpers_ > 0) {
+			helped.notify_all();
+		}
+	}
+	wake.notify_one();
+}
+
+bool WorkerPool::RunOne(int self) {
+	Job job;
+	if (self >= 0) {
+		// newest own task first, its data is most likely cached.
+		Worker *w = workers[self];
+		std::lock_guard<std::mutex> lock(w->mut);
+		if (!w->tasks.empty()) {
+			job = std::move(w->tasks.back());
+			w->tasks.pop_back();
+		}
+	}
+	if (!job.task) {
+		// steal the oldest task of another worker.
+		int n = workers.size();
+		int start = self >= 0 ? self + 1 : next_++;
+		for (int i = 0; i < n && !job.task; i++) {
+			Worker *w = workers[(start + i) % n];
+			std::lock_guard<std::mutex> lock(w->mut);
+			if (!w->tasks.empty()) {
+				job = std::move(w->tasks.front());
+				w->tasks.pop_front();
+			}
+		}
+	}
+	if (!job.task) {
+		return false;
+	}
+	queued_--;
+	{
+		Heap::Use use(job.heap);
+		job.task();
+	}
+	if (job.heap != nullptr) {
+		// what the task captured goes before the heap it may point into.
+		job.task = nullptr;
+		job.heap->Unpin();
+	}
+	if (helpers_ > 0) {
+		// the task may be what a helper is waiting on.
+		std::lock_guard<std::mutex> lock(mut);
+		finished_++;
+		helped.notify_all();
+	}
+	return true;
+}
+
+void WorkerPool::Loop(int id) {
+	current_pool = this;
+	current_worker = id;
+	while (alive_) {
+		if (!RunOne(id)) {
+			std::unique_lock<std::mutex> lock(mut);
+			while (queued_ == 0 && alive_) {
+				wake.wait(lock);
+			}
+		}
+	}
+}
+
+void WorkerPool::HelpUntil(const std::function<bool()>& done) {
+	int self = Self();
+	while (!done()) {
+		if (RunOne(self)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mut);
+		helpers_++;
+		// done is checked again once registered, a task finishing
+		// before then has been seen and one finishing after wakes us.
+		// the timeout covers conditions set outside the pool.
+		uint64_t seen = finished_;
+		if (!done() && queued_ == 0) {
+			helped.wait_for(lock, kHelpTimeout, [this, seen]() { return finished_ != seen || queued_ > 0; });
+		}
+		helpers_--;
+	}
+}
+
+void WorkerPool::ParallelFor(std::size_t n, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& fn) {
+	grain = std::max<std::size_t>(grain, 1);
+	if (n < 2 * grain || workers.size() == 1) {
+		fn(0, n);
+		return;
+	}
+
+	// a few chunks per worker leaves room to balance by stealing.
+	std::size_t chunk = std::max(grain, n / (workers.size() * 4));
+	std::atomic<std::size_t> remaining((n + chunk - 1) / chunk);
+	for (std::size_t begin = chunk; begin < n; begin += chunk) {
+		std::size_t end = std::min(n, begin + chunk);
+		Submit([&fn, &remaining, begin, end]() {
+			fn(begin, end);
+			remaining--;
+		});
+	}
+	// the first chunk runs here.
+	fn(0, std::min(n, chunk));
+	remaining--;
+	HelpUntil([&remaining]() { return remaining == 0; });
+}
+
+} // namespace crisp
@@ -0,0 +1,91 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_POOL_H_
+#define CRISP_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace crisp {
+
+class Heap;
+
+// WorkerPool runs tasks on a fixed set of threads.
+// Each worker has its own deque, it runs its newest task first and
+// steals the oldest tasks of other workers when it runs out.
+class WorkerPool {
+public:
+	typedef std::function<void()> Task;
+
+	WorkerPool(int workers);
+	~WorkerPool();
+
+	// deleted copy and move constructor.
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool(WorkerPool&&) = delete;
+
+	// returns the process wide pool, sized to the hardware.
+	static WorkerPool *Default();
+
+	// queues a task, on the calling worker's deque if it is one of ours.
+	// the task runs with the submitter's current heap.
+	void Submit(Task task);
+
+	// runs queued tasks on the calling thread until done returns true,
+	// so that waiting on other tasks never idles a worker. when there
+	// is nothing to run it sleeps until a task is queued or finishes.
+	void HelpUntil(const std::function<bool()>& done);
+
+	// calls fn over [0, n) split into chunks of at least grain indices,
+	// and returns once every chunk has run.
+	// small ranges are run on the calling thread.
+	void ParallelFor(std::size_t n, std::size_t grain, const std::function<void(std::size_t, std::size_t)>& fn);
+
+	int size() const { return workers.size(); }
+private:
+	struct Job {
+		Task task;
+		Heap *heap;
+	};
+
+	struct Worker {
+		std::mutex mut;
+		std::deque<Job> tasks;
+	};
+
+	// runs the worker loop of worker id.
+	void Loop(int id);
+
+	// runs one task, preferring the deque of worker self.
+	// returns false if there was none to run.
+	bool RunOne(int self);
+
+	// returns the index of the calling thread's worker or -1.
+	int Self() const;
+
+	std::vector<Worker *> workers;
+	std::vector<std::thread> threads;
+
+	std::mutex mut;
+	std::condition_variable wake;
+	// wakes threads in HelpUntil, guarded by mut.
+	std::condition_variable helped;
+	uint64_t finished_ = 0;
+	std::atomic<int> helpers_ = {0};
+	std::atomic<bool> alive_;
+	std::atomic<int> queued_ = {0};
+	std::atomic<unsigned> next_ = {0};
+};
+
+} // namespace crisp
+
+#endif // CRISP_POOL_H_
@@ -0,0 +1,112 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "printer.h"
+
+namespace crisp {
+
+void Printer::Print(const Node *node) {
+	Print(node, 0);
+}
+
+void Printer::PrintBindings(const std::map<std::string, Node *>& bindings) {
+	for (auto& i: bindings) {
+		*os_ << i.first << ": ";
+		Print(i.second, 0);
+		*os_ << '\n';
+	}
+}
+
+void Printer::Print(const Node *node, int depth) {
+	if (node == nullptr) {
+		*os_ << "null";
+		return;
+	}
+
+	auto c = dynamic_cast<const ConstNode *>(node);
+	auto list = dynamic_cast<const ListNode *>(node);
+	auto vlist = dynamic_cast<const VListNode *>(node);
+	auto map = dynamic_cast<const MapNode *>(node);
+	auto set = dynamic_cast<const SetNode *>(node);
+	if (c != nullptr) {
+		*os_ << "'";
+		Print(c->Eval(nullptr), depth);
+		return;
+	} else if (list == nullptr && dynamic_cast<const ParentNode *>(node) != nullptr) {
+		// the root prints its forms each followed by a space.
+		PrintChildren(static_cast<const ParentNode *>(node)->children(), depth, true);
+		return;
+	} else if (list == nullptr && vlist == nullptr && map == nullptr && set == nullptr) {
+		*os_ << node->PPrint();
+		return;
+	}
+
+	if (max_depth_ > 0 && depth >= max_depth_) {
+		*os_ << (map != nullptr ? "{map ...}" : set != nullptr ? "{set ...}" : "(...)");
+		return;
+	}
+	if (!active.insert(node).second) {
+		*os_ << (map != nullptr || set != nullptr ? "{cycle}" : "(cycle)");
+		return;
+	}
+	if (list != nullptr) {
+		*os_ << "(";
+		PrintChildren(list->children(), depth + 1, false);
+		*os_ << ")";
+	} else if (vlist != nullptr) {
+		// walked by Rest, so a long list cut short is not read whole.
+		*os_ << "(";
+		std::size_t i = 0;
+		for (VList l = vlist->list(); !l.empty() && PrintItem(i, l.First(), depth + 1, false); l = l.Rest()) {
+			i++;
+		}
+		*os_ << ")";
+	} else {
+		*os_ << (map != nullptr ? "{map" : "{set");
+		std::size_t i = 0;
+		(map != nullptr ? map->map() : set->set()).ForEach([&](Node *k, Node *v) {
+			if (max_length_ > 0 && i >= max_length_) {
+				if (i++ == max_length_) {
+					*os_ << " ...";
+				}
+				return;
+			}
+			i++;
+			*os_ << " ";
+			if (map != nullptr) {
+				*os_ << "(";
+				Print(k, depth + 1);
+				*os_ << " ";
+				Print(v, depth + 1);
+				*os_ << ")";
+			} else {
+				Print(k, depth + 1);
+			}
+		});
+		*os_ << "}";
+	}
+	active.erase(node);
+}
+
+void Printer::PrintChildren(const std::vector<Node *>& children, int depth, bool trailing) {
+	for (std::size_t i = 0; i < children.size() && PrintItem(i, children[i], depth, trailing); i++) {
+	}
+}
+
+bool Printer::PrintItem(std::size_t i, const Node *node, int depth, bool trailing) {
+	if (max_length_ > 0 && i == max_length_) {
+		*os_ << (trailing ? "... " : " ...");
+		return false;
+	}
+	if (i != 0 && !trailing) {
+		*os_ << " ";
+	}
+	Print(node, depth);
+	if (trailing) {
+		*os_ << " ";
+	}
+	return true;
+}
+
+} // namespace crisp
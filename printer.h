@@ -0,0 +1,55 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_PRINTER_H_
+#define CRISP_PRINTER_H_
+
+#include "tree.h"
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+
+namespace crisp {
+
+// Printer writes the printed form of nodes to a stream while walking
+// them, rather than building the text in memory as PPrint does for
+// leaves. Lists, maps and sets are walked the same way: nested deeper
+// than the depth limit they print as (...), {map ...} or {set ...},
+// longer than the length limit they are cut short with ..., and one
+// that contains itself prints as (cycle) or {cycle}. Limits of 0 are
+// unlimited.
+class Printer {
+public:
+	Printer(std::ostream *os) : os_(os) {}
+
+	void set_max_depth(int depth) { max_depth_ = depth; }
+	void set_max_length(std::size_t length) { max_length_ = length; }
+
+	void Print(const Node *node);
+
+	// prints name: value lines, as the symbol tables do.
+	void PrintBindings(const std::map<std::string, Node *>& bindings);
+private:
+	void Print(const Node *node, int depth);
+
+	// prints children separated by sep, after each one if trailing.
+	void PrintChildren(const std::vector<Node *>& children, int depth, bool trailing);
+	// prints item i of a sequence, returning false if it is
+	// past the length limit and the sequence is cut short.
+	bool PrintItem(std::size_t i, const Node *node, int depth, bool trailing);
+
+	std::ostream *os_;
+	int max_depth_ = 0;
+	std::size_t max_length_ = 0;
+
+	// lists being printed.
+	std::unordered_set<const Node *> active;
+};
+
+} // namespace crisp
+
+#endif // CRISP_PRINTER_H_
@@ -0,0 +1,225 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "profile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace crisp {
+
+thread_local unsigned long node_allocations = 0;
+
+std::atomic<bool> Profiler::enabled_ = {false};
+
+struct Tree;
+
+// a node of a thread's call tree.
+struct Call {
+	Call(Call *p, const std::string& l) : parent(p), tree(p != nullptr ? p->tree : nullptr), label(l) {}
+	Call *parent;
+	Tree *tree;
+	std::string label;
+	std::map<std::string, Call *> children;
+	unsigned long count = 0;
+	long inclusive_ns = 0;
+	long child_ns = 0;
+	unsigned long allocations = 0;
+	unsigned long child_allocations = 0;
+};
+
+// a call tree started by a thread. fibers that move between threads
+// keep recording into the tree they started in, so the calls of a tree
+// are updated and merged under its lock.
+struct Tree {
+	Tree() : root(nullptr, "") { root.tree = this; }
+	std::mutex mut;
+	Call root;
+};
+
+namespace {
+
+long NowNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the call trees of every thread that has profiled, never freed
+// so that reports can include threads that have exited.
+std::mutex trees_mut;
+std::vector<Tree *> trees;
+
+// the current call of this thread, or of the fiber it runs,
+// and the call that fiber was spawned in.
+thread_local Call *current = nullptr;
+thread_local Call *spawner = nullptr;
+
+Call *Current() {
+	if (current == nullptr) {
+		Tree *t = new Tree();
+		current = &t->root;
+		std::lock_guard<std::mutex> lock(trees_mut);
+		trees.push_back(t);
+	}
+	return current;
+}
+
+// merges the tree from into into.
+void Merge(const Call *from, Call *into) {
+	into->count += from->count;
+	into->inclusive_ns += from->inclusive_ns;
+	into->child_ns += from->child_ns;
+	into->allocations += from->allocations;
+	into->child_allocations += from->child_allocations;
+	for (auto& i: from->children) {
+		auto& c = into->children[i.first];
+		if (c == nullptr) {
+			c = new Call(into, i.first);
+		}
+		Merge(i.second, c);
+	}
+}
+
+// returns the merged tree of every thread, the caller owns it.
+// calls still running are counted once they return.
+Call *Merged() {
+	Call *root = new Call(nullptr, "");
+	std::lock_guard<std::mutex> lock(trees_mut);
+	for (auto i: trees) {
+		std::lock_guard<std::mutex> tree_lock(i->mut);
+		Merge(&i->root, root);
+	}
+	return root;
+}
+
+void Free(Call *call) {
+	for (auto& i: call->children) {
+		Free(i.second);
+	}
+	delete call;
+}
+
+struct Totals {
+	unsigned long count = 0;
+	long inclusive_ns = 0;
+	long exclusive_ns = 0;
+	unsigned long allocations = 0;
+};
+
+// sums calls by label. recursive calls add to the inclusive
+// time only at their outermost call.
+void Sum(const Call *call, std::map<std::string, int> *active, std::map<std::string, Totals> *totals) {
+	for (auto& i: call->children) {
+		const Call *c = i.second;
+		Totals& t = (*totals)[c->label];
+		t.count += c->count;
+		t.exclusive_ns += c->inclusive_ns - c->child_ns;
+		t.allocations += c->allocations - c->child_allocations;
+		if ((*active)[c->label]++ == 0) {
+			t.inclusive_ns += c->inclusive_ns;
+		}
+		Sum(c, active, totals);
+		(*active)[c->label]--;
+	}
+}
+
+void Fold(const Call *call, const std::string& stack, std::ostream *os) {
+	for (auto& i: call->children) {
+		const Call *c = i.second;
+		std::string s = stack.empty() ? c->label : stack + ";" + c->label;
+		long us = (c->inclusive_ns - c->child_ns) / 1000;
+		if (us > 0) {
+			*os << s << " " << us << "\n";
+		}
+		Fold(c, s, os);
+	}
+}
+
+// returns label with the separators of collapsed stacks replaced.
+std::string Clean(std::string label) {
+	std::replace(label.begin(), label.end(), ';', ':');
+	std::replace(label.begin(), label.end(), '\n', ' ');
+	return label;
+}
+
+} // namespace
+
+Profiler::Context Profiler::Spawned() {
+	Call *call = enabled() ? Current() : nullptr;
+	return Context{call, call, 0};
+}
+
+Profiler::Context Profiler::Swap(const Context& c) {
+	Context prev{current, spawner, node_allocations};
+	current = c.call;
+	spawner = c.spawner;
+	node_allocations = c.allocations;
+	return prev;
+}
+
+Profiler::Frame::Frame(const std::string& label) {
+	Call *parent = Current();
+	std::string l = Clean(label);
+	{
+		std::lock_guard<std::mutex> lock(parent->tree->mut);
+		auto& c = parent->children[l];
+		if (c == nullptr) {
+			c = new Call(parent, l);
+		}
+		call = c;
+	}
+	charge_parent = parent != spawner;
+	current = call;
+	start_allocations = node_allocations;
+	start_ns = NowNs();
+}
+
+Profiler::Frame::~Frame() {
+	long ns = NowNs() - start_ns;
+	unsigned long allocations = node_allocations - start_allocations;
+	std::lock_guard<std::mutex> lock(call->tree->mut);
+	call->count++;
+	call->inclusive_ns += ns;
+	call->allocations += allocations;
+	if (charge_parent) {
+		call->parent->child_ns += ns;
+		call->parent->child_allocations += allocations;
+	}
+	current = call->parent;
+}
+
+void Profiler::Report(std::ostream *os) {
+	Call *root = Merged();
+	std::map<std::string, int> active;
+	std::map<std::string, Totals> totals;
+	Sum(root, &active, &totals);
+	Free(root);
+
+	std::vector<std::pair<std::string, Totals>> sorted(totals.begin(), totals.end());
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Totals>& a, const std::pair<std::string, Totals>& b) {
+		return a.second.exclusive_ns > b.second.exclusive_ns;
+	});
+
+	*os << std::setw(10) << "calls" << std::setw(14) << "incl ms" << std::setw(14) << "excl ms"
+		<< std::setw(12) << "allocs" << "  function\n";
+	for (auto& i: sorted) {
+		*os << std::setw(10) << i.second.count
+			<< std::setw(14) << std::fixed << std::setprecision(3) << i.second.inclusive_ns / 1e6
+			<< std::setw(14) << i.second.exclusive_ns / 1e6
+			<< std::setw(12) << i.second.allocations
+			<< "  " << i.first << "\n";
+	}
+}
+
+void Profiler::Collapsed(std::ostream *os) {
+	Call *root = Merged();
+	Fold(root, "", os);
+	Free(root);
+}
+
+} // namespace crisp
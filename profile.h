@@ -0,0 +1,69 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_PROFILE_H_
+#define CRISP_PROFILE_H_
+
+#include <atomic>
+#include <ostream>
+#include <string>
+
+namespace crisp {
+
+struct Call;
+
+// number of nodes allocated by this thread, or by the fiber it runs.
+extern thread_local unsigned long node_allocations;
+
+// Profiler records a call tree of the calls made by the evaluator,
+// with call counts, inclusive and exclusive time and node allocations.
+// Each thread records into its own tree, which are merged when a
+// report is written. When disabled the evaluator only tests a flag.
+class Profiler {
+public:
+	static void Enable() { enabled_.store(true, std::memory_order_relaxed); }
+	static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+	// Context is the call and allocation count of whatever runs on a
+	// thread. A fiber swaps its own in while it runs, so its frames
+	// nest and count the same after it moves to another thread.
+	struct Context {
+		Call *call;
+		// the call the fiber was spawned in. it does not wait for
+		// the fiber, so the fiber's time is not charged to it.
+		Call *spawner;
+		unsigned long allocations;
+	};
+	// returns the context of a fiber spawned from here,
+	// whose calls nest under the current call.
+	static Context Spawned();
+	// makes c the thread's context, returning the previous one.
+	static Context Swap(const Context& c);
+
+	// Frame records one call to label while it is in scope.
+	class Frame {
+	public:
+		Frame(const std::string& label);
+		~Frame();
+	private:
+		Call *call;
+		bool charge_parent;
+		long start_ns;
+		unsigned long start_allocations;
+	};
+
+	// writes the calls by label, sorted by exclusive time.
+	static void Report(std::ostream *os);
+
+	// writes one line per distinct stack, labels separated by
+	// semicolons and followed by the stack's exclusive microseconds,
+	// as read by flamegraph tools.
+	static void Collapsed(std::ostream *os);
+private:
+	static std::atomic<bool> enabled_;
+};
+
+} // namespace crisp
+
+#endif // CRISP_PROFILE_H_
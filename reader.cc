@@ -0,0 +1,188 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "reader.h"
+#include "lexer.h"
+
+#include <climits>
+#include <cstring>
+
+namespace crisp {
+namespace reader {
+
+Cursor::Event Cursor::Fail(const char *msg) {
+	error_ = msg;
+	text_ = StringPiece();
+	return kError;
+}
+
+Cursor::Event Cursor::Next() {
+	if (error_ != nullptr) {
+		return kError;
+	}
+	if (pending_ > 0) {
+		if (quoted_) {
+			return Fail("nothing to quote");
+		}
+		pending_--;
+		depth_--;
+		return kEndList;
+	}
+	const char *end = input_.end();
+	for (;;) {
+		while (p < end && lexer::Whitespace::IsDelim(*p)) {
+			p++;
+		}
+		if (p == end) {
+			if (quoted_) {
+				return Fail("nothing to quote");
+			}
+			if (depth_ > 0) {
+				return Fail("unexpected EOF");
+			}
+			return kEnd;
+		}
+		if (lexer::Comment::IsDelim(*p)) {
+			while (p < end && *p != '\n') {
+				p++;
+			}
+			continue;
+		}
+		break;
+	}
+
+	const char *start = p;
+	char c = *p;
+	if (c == ')' || c == ']') {
+		if (quoted_) {
+			return Fail("nothing to quote");
+		}
+	} else if (lexer::Tick::IsDelim(c)) {
+		p++;
+		quoted_ = true;
+		return kQuote;
+	} else {
+		// whatever follows is the quoted datum or an error.
+		quoted_ = false;
+	}
+	if (c == '(') {
+		p++;
+		depth_++;
+		return kBeginList;
+	} else if (c == ')') {
+		if (depth_ == 0) {
+			return Fail("unmatched ')'");
+		}
+		p++;
+		depth_--;
+		return kEndList;
+	} else if (c == ']') {
+		// closes every open list.
+		p++;
+		pending_ = depth_;
+		return Next();
+	} else if (int n = lexer::Ident::Length(p, end - p, true)) {
+		do {
+			p += n;
+		} while (p < end && (n = lexer::Ident::Length(p, end - p, false)) > 0);
+		text_ = StringPiece(start, p - start);
+		return kAtom;
+	} else if (lexer::Num::IsDelim(c)) {
+		number_ = 0;
+		while (p < end && lexer::Num::Is(*p)) {
+			if (*p != '_') {
+				int digit = *p - '0';
+				if (number_ > (LLONG_MAX - digit) / 10) {
+					return Fail("number out of range");
+				}
+				number_ = number_ * 10 + digit;
+			}
+			p++;
+		}
+		text_ = StringPiece(start, p - start);
+		return kNumber;
+	} else if (lexer::String::IsDelim(c)) {
+		const char *q = static_cast<const char *>(std::memchr(p + 1, c, end - p - 1));
+		if (q == nullptr) {
+			return Fail("unterminated string");
+		}
+		text_ = StringPiece(p + 1, q - p - 1);
+		p = q + 1;
+		return kString;
+	} else {
+		return Fail("unexpected character");
+	}
+}
+
+bool Cursor::Skip() {
+	if (error_ != nullptr || depth_ == 0) {
+		return false;
+	}
+	// only parens, strings and comments matter inside the list.
+	const std::size_t target = depth_ - 1;
+	const char *end = input_.end();
+	while (p < end) {
+		char c = *p++;
+		if (c == '(') {
+			depth_++;
+		} else if (c == ')') {
+			if (--depth_ == target) {
+				return true;
+			}
+		} else if (c == ']') {
+			pending_ = target;
+			depth_ = target;
+			return true;
+		} else if (lexer::String::IsDelim(c)) {
+			const char *q = static_cast<const char *>(std::memchr(p, c, end - p));
+			if (q == nullptr) {
+				Fail("unterminated string");
+				return false;
+			}
+			p = q + 1;
+		} else if (lexer::Comment::IsDelim(c)) {
+			while (p < end && *p != '\n') {
+				p++;
+			}
+		}
+	}
+	Fail("unexpected EOF");
+	return false;
+}
+
+bool Read(Cursor *cursor, Handler *h) {
+	for (;;) {
+		bool more = true;
+		switch (cursor->Next()) {
+		case Cursor::kBeginList:
+			more = h->BeginList();
+			break;
+		case Cursor::kEndList:
+			more = h->EndList();
+			break;
+		case Cursor::kAtom:
+			more = h->Atom(cursor->text());
+			break;
+		case Cursor::kNumber:
+			more = h->Number(cursor->number(), cursor->text());
+			break;
+		case Cursor::kString:
+			more = h->String(cursor->text());
+			break;
+		case Cursor::kQuote:
+			more = h->Quote();
+			break;
+		case Cursor::kEnd:
+			return true;
+		case Cursor::kError:
+			return false;
+		}
+		if (!more) {
+			return false;
+		}
+	}
+}
+
+} // namespace reader
+} // namespace crisp
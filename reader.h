@@ -0,0 +1,90 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_READER_H_
+#define CRISP_READER_H_
+
+#include "piece.h"
+
+#include <cstddef>
+
+namespace crisp {
+namespace reader {
+
+// Cursor reads the S-expressions of a buffer one event at a time,
+// using the lexer's character classes. It never allocates, the text
+// of atoms, numbers and strings is a view into the buffer.
+class Cursor {
+public:
+	enum Event {
+		kBeginList,
+		kEndList,
+		kAtom,
+		kNumber,
+		kString,
+		// a tick, the next datum is quoted.
+		kQuote,
+		kEnd,
+		kError,
+	};
+
+	Cursor(StringPiece input) : input_(input), p(input.data()) {}
+
+	// returns the next event. kEnd and kError are returned
+	// again by every following call.
+	Event Next();
+
+	// after kBeginList, moves past the list's end without returning
+	// any of its events. returns false on a syntax error.
+	bool Skip();
+
+	// returns the text of the last atom or number,
+	// or the contents of the last string without its quotes.
+	StringPiece text() const { return text_; }
+	// returns the value of the last number. numbers that do
+	// not fit a long long are a syntax error.
+	long long number() const { return number_; }
+	// returns the number of lists open.
+	std::size_t depth() const { return depth_; }
+	// returns the offset into the input of the next character read.
+	std::size_t offset() const { return p - input_.data(); }
+	// returns a description of the syntax error after kError.
+	const char *error() const { return error_; }
+private:
+	Event Fail(const char *msg);
+
+	StringPiece input_;
+	const char *p;
+	StringPiece text_;
+	long long number_ = 0;
+	std::size_t depth_ = 0;
+	// list ends still to return after a ']'.
+	std::size_t pending_ = 0;
+	// a tick was read and its datum was not.
+	bool quoted_ = false;
+	const char *error_ = nullptr;
+};
+
+// Handler receives the events of Read, a method returning
+// false stops reading.
+class Handler {
+public:
+	virtual ~Handler() {}
+	virtual bool BeginList() { return true; }
+	virtual bool EndList() { return true; }
+	virtual bool Atom(StringPiece text) { return true; }
+	virtual bool Number(long long value, StringPiece text) { return true; }
+	virtual bool String(StringPiece text) { return true; }
+	// the next datum is quoted.
+	virtual bool Quote() { return true; }
+};
+
+// calls h for each event of input. returns false if input
+// has a syntax error, described by cursor, or h stopped reading.
+bool Read(Cursor *cursor, Handler *h);
+
+} // namespace reader
+} // namespace crisp
+
+#endif // CRISP_READER_H_
@@ -4,14 +4,27 @@
 // found in the LICENSE file.
 
 #include "scanner.h"
+#include "metrics.h"
+#include "utf8.h"
+
+#include <cstring>
+#include <sstream>
 
 using namespace crisp;
 
+namespace {
+
+const std::size_t kBlockSize = 64 * 1024;
+
+metrics::Counter bytes_scanned("crisp_scanner_bytes_total", "Bytes read from input by scanners.");
+
+} // namespace
+
 InputScanner::InputScanner(std::istream *stream) : is(stream) {}
 
 bool InputScanner::Empty() const {
-	if (backstack.empty()) {
-		return is->eof();
+	if (backstack.empty() && begin == end) {
+		return is->eof() || !error_.empty();
 	} else {
 		return false;
 	}
@@ -21,31 +34,76 @@ Position InputScanner::pos() const {
 	return pos_;
 }
 
+std::string InputScanner::error() const {
+	return error_;
+}
+
+bool InputScanner::Fill() {
+	if (!error_.empty()) {
+		return false;
+	}
+	// move a held partial sequence to the front of the block.
+	std::size_t carry = held - end;
+	buf.resize(kBlockSize + carry);
+	memmove(&buf[0], &buf[end], carry);
+	is->read(&buf[carry], kBlockSize);
+	std::size_t n = carry + is->gcount();
+	bytes_scanned.Inc(is->gcount());
+
+	bool partial;
+	begin = 0;
+	end = utf8::ValidPrefix(buf.data(), n, &partial);
+	held = n;
+	if (end < n && (!partial || is->eof())) {
+		// stop at the last whole character, and report the rest.
+		Position at = pos_;
+		for (std::size_t i = 0; i < end; i++) {
+			if (buf[i] == '\n') {
+				at.chnum = 0;
+				at.linenum++;
+			} else if ((buf[i] & 0xC0) != 0x80) {
+				at.chnum++;
+			}
+		}
+		std::ostringstream str;
+		str << (partial ? "truncated" : "invalid") << " UTF-8 at " << at.linenum + 1 << ":" << at.chnum + 1;
+		error_ = str.str();
+		held = end;
+	}
+	return begin < end;
+}
+
 char InputScanner::Next() {
 	char next_char;
-	if (backstack.empty()) {
-		next_char = is->get();
-	} else {
+	if (!backstack.empty()) {
 		next_char = backstack.top();
 		backstack.pop();
+	} else if (begin < end || Fill()) {
+		next_char = buf[begin++];
+	} else {
+		return EOF;
 	}
 	if (next_char == '\n') {
 		// line number rollover
 		pos_.chnum = 0;
 		pos_.linenum++;
-	} else {
+	} else if ((next_char & 0xC0) != 0x80) {
+		// continuation bytes belong to the character before them.
 		pos_.chnum++;
 	}
 	return next_char;
 }
 
 void InputScanner::Back(char c) {
+	if (c == EOF) {
+		return;
+	}
 	if (c == '\n') {
 		// the last line length is unknown,
 		// so chnum is reset to 0 and linenum is decremented.
 		pos_.chnum = 0;
 		pos_.linenum--;
-	} else {
+	} else if ((c & 0xC0) != 0x80) {
 		pos_.chnum--;
 	}
 	backstack.push(c);
@@ -36,8 +36,14 @@ public:
 
 	// returns the current position in the text.
 	virtual Position pos() const = 0;
+
+	// returns why the input ended early, or the empty string
+	// if it was read to the end. input must be valid UTF-8.
+	virtual std::string error() const = 0;
 };
 
+// reads its stream in blocks, validating each block as UTF-8.
+// positions count code points, not bytes.
 class InputScanner : public ScannerInterface {
 public:
 	InputScanner(std::istream *stream);
@@ -51,10 +57,22 @@ public:
 	virtual char Next();
 	virtual void Back(char c);
 	virtual char Peek();
+	virtual std::string error() const;
 private:
+	// reads and validates the next block of the stream.
+	// returns false once there is nothing left to scan.
+	bool Fill();
+
 	Position pos_;
 	std::stack<char> backstack;
 	std::istream *is;
+
+	// buf[begin, end) is validated input not yet scanned.
+	// a sequence cut off by the end of a block is kept
+	// at buf[end, held) until the next block completes it.
+	std::string buf;
+	std::size_t begin = 0, end = 0, held = 0;
+	std::string error_;
 };
 
 } // namesapce crisp
@@ -0,0 +1,175 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "server.h"
+#include "parser.h"
+#include "fuel.h"
+#include "heap.h"
+#include "io.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace crisp {
+
+namespace {
+
+// seconds a connection may stall reading its script or its reply.
+const int kIoTimeout = 30;
+
+} // namespace
+
+bool Server::Listen(const std::string& path) {
+	struct sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	// only a stale socket is replaced, never some other file.
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EEXIST;
+			return false;
+		}
+		unlink(path.c_str());
+	}
+	fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd_ < 0) {
+		return false;
+	}
+	// a client that hangs up before its reply is written
+	// must not take the server down with it.
+	signal(SIGPIPE, SIG_IGN);
+	if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd_, SOMAXCONN) != 0) {
+		close(fd_);
+		fd_ = -1;
+		return false;
+	}
+	return true;
+}
+
+void Server::Serve() {
+	for (;;) {
+		int fd = accept(fd_, nullptr, nullptr);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "server: accept: " << strerror(errno) << std::endl;
+			return;
+		}
+		std::thread(&Server::Handle, this, fd).detach();
+	}
+}
+
+std::string Server::Eval(const std::string& script) {
+	// the script's writes go back to its client,
+	// not to the server's standard out.
+	auto out = std::make_shared<Output>();
+	Output::Use use(out.get());
+	std::string reply = Run(script);
+	return out->Take() + reply;
+}
+
+std::string Server::Run(const std::string& script) {
+	if (session_ != nullptr) {
+		std::istringstream in(script);
+		auto tree = dynamic_cast<ParentNode *>(parser::Parse(&in, false));
+		std::string values, updates;
+		for (auto i: tree->children()) {
+			auto u = session_->Eval(i);
+			values += (values.empty() ? "" : " ") + u[0].value->PPrint();
+			for (auto j = u.begin() + 1; j != u.end(); j++) {
+				updates += "=> " + j->form->PPrint() + " " + j->value->PPrint() + "\n";
+			}
+		}
+		return ">> " + values + "\n" + updates;
+	}
+
+	// the request's scope, tree and values are freed with its heap,
+	// which what it started keeps pinned until they are done.
+	Heap *heap = new Heap();
+	std::string reply;
+	{
+		Heap::Use use(heap);
+		reply = RunScoped(script);
+	}
+	heap->Unpin();
+	return reply;
+}
+
+std::string Server::RunScoped(const std::string& script) {
+	// the child scope holds the request's definitions,
+	// everything else resolves to the warm globals.
+	Node::State state(new Scope(warm_->symbol_table()));
+
+	std::istringstream in(script);
+	Node *tree = parser::Parse(&in, false);
+	if (steps_ == 0 && allocations_ == 0) {
+		Node *node = tree->Eval(&state);
+		return node != nullptr ? std::string(">> ") + node->PPrint() + "\n" : "";
+	}
+
+	MeteredEval eval(WorkerPool::Default(), tree, &state, steps_, allocations_);
+	std::string reply;
+	if (eval.Wait() == MeteredEval::kExhausted) {
+		// the script unwinds with errors, its partial result is still sent.
+		eval.Cancel();
+		eval.Wait();
+		reply = "Error: fuel exhausted\n";
+	}
+	Node *node = eval.result();
+	return reply + (node != nullptr ? std::string(">> ") + node->PPrint() + "\n" : "");
+}
+
+void Server::Handle(int fd) {
+	// a client that never shuts down its write side, or never reads,
+	// would otherwise hold its thread forever.
+	struct timeval timeout = {kIoTimeout, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	std::string script;
+	char buf[4096];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+		if (n > 0) {
+			script.append(buf, n);
+		}
+	}
+	if (n < 0) {
+		// timed out or failed, the partial script is not evaluated.
+		close(fd);
+		return;
+	}
+
+	std::string reply = Eval(script);
+	for (std::size_t off = 0; off < reply.size();) {
+		n = write(fd, reply.data() + off, reply.size() - off);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n <= 0) {
+			break;
+		}
+		off += n;
+	}
+	close(fd);
+}
+
+} // namespace crisp
@@ -0,0 +1,75 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_SERVER_H_
+#define CRISP_SERVER_H_
+
+#include "session.h"
+#include "tree.h"
+
+#include <cstdint>
+#include <string>
+
+namespace crisp {
+
+// Server evaluates scripts sent over a unix domain socket against a
+// warm state, so requests do not pay for startup or the prelude.
+// A client writes a script and shuts down its write side, the server
+// replies with the printed result and closes the connection. A client
+// that stalls for 30 seconds is disconnected without a reply.
+//
+// Each request runs in a scope of its own, whose parent is the warm
+// state's globals, so definitions made by a request are not seen by
+// other requests. In a live session they are instead kept, and the
+// forms that depend on a name a request rebinds are evaluated again.
+class Server {
+public:
+	Server(Node::State *warm) : warm_(warm) {}
+
+	// binds the socket at path, replacing a stale socket file.
+	// returns false on failure or if path is some other file.
+	// ignores SIGPIPE, so that clients hanging up are only write errors.
+	bool Listen(const std::string& path);
+
+	// accepts connections forever, serving each on its own thread.
+	void Serve();
+
+	// evaluates a script in a fresh child scope, or in the
+	// session if there is one, and returns the printed result
+	// preceded by what the script wrote. writes from fibers
+	// still running once the script is done are dropped.
+	// outside a session, the nodes of a script are allocated from a
+	// heap of its own, freed once the script and the fibers and
+	// futures it started are done.
+	std::string Eval(const std::string& script);
+
+	// bounds the calls and node allocations of each request,
+	// requests over budget are cancelled. 0 is unlimited.
+	void set_fuel(uint64_t steps, uint64_t allocations) {
+		steps_ = steps;
+		allocations_ = allocations;
+	}
+	// evaluates requests in session, nullptr for a fresh scope each.
+	// the forms evaluated again are replied as well, as
+	// "=> form value" lines. the session's fuel applies per form, and
+	// its definitions are kept, so it does not get a heap of its own.
+	void set_session(Session *session) { session_ = session; }
+private:
+	void Handle(int fd);
+	// returns the printed result of script.
+	std::string Run(const std::string& script);
+	// returns the printed result of script run in a child scope,
+	// allocating from the current heap.
+	std::string RunScoped(const std::string& script);
+
+	Node::State *warm_;
+	Session *session_ = nullptr;
+	int fd_ = -1;
+	uint64_t steps_ = 0;
+	uint64_t allocations_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_SERVER_H_
@@ -0,0 +1,151 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "session.h"
+#include "fuel.h"
+#include "metrics.h"
+
+#include <algorithm>
+
+namespace crisp {
+
+namespace {
+
+metrics::Counter reevaluated("crisp_session_reevaluations_total", "Forms evaluated again because a name they read was bound.");
+
+// returns true if a and b have a name in common.
+bool Intersects(const std::set<std::string>& a, const std::set<std::string>& b) {
+	for (auto& i: a) {
+		if (b.count(i) != 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+void Session::Recorder::Read(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mut);
+	reads_.insert(name);
+}
+
+void Session::Recorder::Wrote(const std::string& name) {
+	std::lock_guard<std::mutex> lock(mut);
+	writes_.insert(name);
+}
+
+bool Session::Recorder::ReadAny(const std::set<std::string>& names) {
+	std::lock_guard<std::mutex> lock(mut);
+	return Intersects(reads_, names);
+}
+
+std::set<std::string> Session::Recorder::writes() {
+	std::lock_guard<std::mutex> lock(mut);
+	return writes_;
+}
+
+Session::Session(Node::State *s) : state(s), globals(static_cast<GlobalScope *>(s->symbol_table())) {}
+
+Node *Session::Run(Entry *entry) {
+	// the old recorder may still be told of reads by what the form
+	// started before, they no longer count.
+	entry->recorder = std::make_shared<Recorder>(globals);
+	ScopeObserver::Use observe(entry->recorder.get());
+	if (steps_ == 0 && allocations_ == 0) {
+		return entry->form->Eval(state);
+	}
+	MeteredEval eval(WorkerPool::Default(), entry->form, state, steps_, allocations_);
+	if (eval.Wait() == MeteredEval::kExhausted) {
+		// the form unwinds with errors, its partial result is dropped.
+		eval.Cancel();
+		eval.Wait();
+		return new ErrorNode("fuel exhausted");
+	}
+	return eval.result();
+}
+
+std::vector<Session::Update> Session::Eval(Node *form) {
+	std::lock_guard<std::mutex> lock(mut);
+	std::vector<Update> updates;
+	Entry entry{form};
+	updates.push_back(Update{form, Run(&entry)});
+
+	std::set<std::string> dirty = entry.recorder->writes();
+	if (!dirty.empty()) {
+		// forms whose bindings were all replaced no longer define anything.
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [&dirty](const Entry& e) {
+			std::set<std::string> w = e.recorder->writes();
+			return !w.empty() && std::includes(dirty.begin(), dirty.end(), w.begin(), w.end());
+		}), entries.end());
+
+		std::vector<std::set<std::string>> writes;
+		for (auto& i: entries) {
+			writes.push_back(i.recorder->writes());
+		}
+		std::set<std::size_t> pending, done;
+		for (;;) {
+			// pending is every form not yet run that reads a dirty name or
+			// what another pending form binds.
+			for (bool grew = true; grew; ) {
+				grew = false;
+				for (std::size_t i = 0; i < entries.size(); i++) {
+					if (pending.count(i) != 0 || done.count(i) != 0 || !entries[i].recorder->ReadAny(dirty)) {
+						continue;
+					}
+					pending.insert(i);
+					dirty.insert(writes[i].begin(), writes[i].end());
+					grew = true;
+				}
+			}
+			if (pending.empty()) {
+				break;
+			}
+			// run the first form no other pending form binds a read of,
+			// or the first pending form if they form a cycle.
+			std::size_t next = *pending.begin();
+			for (auto i: pending) {
+				bool ready = true;
+				for (auto j: pending) {
+					if (j != i && entries[i].recorder->ReadAny(writes[j])) {
+						ready = false;
+						break;
+					}
+				}
+				if (ready) {
+					next = i;
+					break;
+				}
+			}
+			pending.erase(next);
+			done.insert(next);
+			reevaluated.Inc();
+			updates.push_back(Update{entries[next].form, Run(&entries[next])});
+			writes[next] = entries[next].recorder->writes();
+			dirty.insert(writes[next].begin(), writes[next].end());
+		}
+	}
+	entries.push_back(entry);
+	return updates;
+}
+
+std::vector<Session::Update> Session::EvalAll(Node *root) {
+	std::vector<Update> updates;
+	auto parent = dynamic_cast<ParentNode *>(root);
+	if (parent == nullptr) {
+		return updates;
+	}
+	for (auto i: parent->children()) {
+		auto u = Eval(i);
+		updates.insert(updates.end(), u.begin(), u.end());
+	}
+	return updates;
+}
+
+std::size_t Session::size() {
+	std::lock_guard<std::mutex> lock(mut);
+	return entries.size();
+}
+
+} // namespace crisp
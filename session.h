@@ -0,0 +1,95 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_SESSION_H_
+#define CRISP_SESSION_H_
+
+#include "tree.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace crisp {
+
+// Session evaluates top level forms one at a time in a long lived
+// state, and records the global names each form read and bound.
+// values defined by def are evaluated where they are used, so a form
+// also reads the names read by the definitions it uses.
+//
+// when a form binds a name, the earlier forms that read it are
+// evaluated again, and in turn the forms that read what those bind.
+// a form runs after the affected forms that bind what it reads, ties
+// and cycles going to the form first evaluated, and at most once per
+// update. earlier forms binding only names the new form binds are
+// superseded and forgotten.
+class Session {
+public:
+	// the state's symbol table must be a GlobalScope.
+	Session(Node::State *state);
+
+	struct Update {
+		Node *form;
+		Node *value;
+	};
+
+	// evaluates form, then the forms that depend on what it bound.
+	// returns the value of form followed by those evaluated again.
+	std::vector<Update> Eval(Node *form);
+
+	// evaluates each top level form of root in turn.
+	std::vector<Update> EvalAll(Node *root);
+
+	// returns the number of forms remembered.
+	std::size_t size();
+
+	// bounds the calls and node allocations of each form evaluated,
+	// forms over budget are cancelled and yield an error. 0 is unlimited.
+	void set_fuel(uint64_t steps, uint64_t allocations) {
+		steps_ = steps;
+		allocations_ = allocations;
+	}
+private:
+	// records the names looked up and bound during a form, including
+	// by the fibers and futures it started, for as long as they run.
+	class Recorder : public ScopeObserver {
+	public:
+		explicit Recorder(const GlobalScope *scope) : ScopeObserver(scope) {}
+		virtual void Read(const std::string& name);
+		virtual void Wrote(const std::string& name);
+
+		// returns true if the form read any of names.
+		bool ReadAny(const std::set<std::string>& names);
+		std::set<std::string> writes();
+	private:
+		std::mutex mut;
+		std::set<std::string> reads_;
+		std::set<std::string> writes_;
+	};
+
+	struct Entry {
+		Node *form;
+		std::shared_ptr<Recorder> recorder;
+	};
+
+	// evaluates entry's form, replacing what it read and bound.
+	Node *Run(Entry *entry);
+
+	Node::State *state;
+	GlobalScope *globals;
+
+	// serializes evaluation, reads are recorded from any thread.
+	std::mutex mut;
+	// forms in the order they were first evaluated.
+	std::vector<Entry> entries;
+	uint64_t steps_ = 0;
+	uint64_t allocations_ = 0;
+};
+
+} // namespace crisp
+
+#endif // CRISP_SESSION_H_
@@ -0,0 +1,221 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "shared_string.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace crisp {
+namespace shared_string {
+
+// a buffer of characters, or a rope of two strings whose
+// characters are copied into a buffer when first needed.
+struct Rep {
+	Rep(std::size_t n) : data(new char[n]), size(n) {}
+	Rep(const SharedString& l, const SharedString& r, int d)
+		: size(l.size() + r.size()), left(l), right(r), depth(d) {}
+	Rep(StringPiece s, std::shared_ptr<const void> o)
+		: data(const_cast<char *>(s.data())), size(s.size()), owner(std::move(o)) {}
+	~Rep() {
+		if (owner == nullptr) {
+			delete[] data.load(std::memory_order_relaxed);
+		}
+	}
+
+	// returns the characters, flattening a rope once.
+	const char *Flat() {
+		const char *d = data.load(std::memory_order_acquire);
+		if (d != nullptr) {
+			return d;
+		}
+		char *flat = new char[size];
+		left.CopyTo(0, left.size(), flat);
+		right.CopyTo(0, right.size(), flat + left.size());
+		char *expected = nullptr;
+		if (!data.compare_exchange_strong(expected, flat, std::memory_order_acq_rel)) {
+			// another reader flattened it first.
+			delete[] flat;
+			return expected;
+		}
+		return flat;
+	}
+
+	std::atomic<int> refs = {1};
+	std::atomic<char *> data = {nullptr};
+	std::size_t size;
+	SharedString left, right;
+	// holds the characters of a view, which are never written.
+	std::shared_ptr<const void> owner;
+	// ropes deeper than kMaxDepth are flattened on concat.
+	int depth = 0;
+};
+
+namespace {
+
+const int kMaxDepth = 32;
+// concats shorter than this are copied rather than roped.
+const std::size_t kMinRope = 256;
+
+Rep *Ref(Rep *r) {
+	r->refs.fetch_add(1, std::memory_order_relaxed);
+	return r;
+}
+
+void Unref(Rep *r) {
+	if (r->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		delete r;
+	}
+}
+
+} // namespace
+} // namespace shared_string
+
+using shared_string::Rep;
+
+SharedString::SharedString(StringPiece s) : size_(s.size()) {
+	if (small()) {
+		if (size_ > 0) {
+			std::memcpy(inline_, s.data(), size_);
+		}
+		return;
+	}
+	Rep *r = new Rep(size_);
+	std::memcpy(r->data.load(std::memory_order_relaxed), s.data(), size_);
+	heap_.rep = r;
+	heap_.offset = 0;
+}
+
+SharedString SharedString::View(StringPiece s, std::shared_ptr<const void> owner) {
+	if (s.size() <= kInline) {
+		return SharedString(s);
+	}
+	SharedString v;
+	v.size_ = s.size();
+	v.heap_.rep = new Rep(s, std::move(owner));
+	v.heap_.offset = 0;
+	return v;
+}
+
+SharedString::SharedString(const SharedString& other) : size_(other.size_) {
+	if (small()) {
+		std::memcpy(inline_, other.inline_, kInline);
+	} else {
+		heap_.rep = shared_string::Ref(other.heap_.rep);
+		heap_.offset = other.heap_.offset;
+	}
+}
+
+SharedString& SharedString::operator=(const SharedString& other) {
+	if (this != &other) {
+		SharedString copy(other);
+		this->~SharedString();
+		new (this) SharedString(copy);
+	}
+	return *this;
+}
+
+SharedString::~SharedString() {
+	if (!small()) {
+		shared_string::Unref(heap_.rep);
+	}
+}
+
+StringPiece SharedString::piece() const {
+	if (small()) {
+		return StringPiece(inline_, size_);
+	}
+	return StringPiece(heap_.rep->Flat() + heap_.offset, size_);
+}
+
+void SharedString::CopyTo(std::size_t pos, std::size_t n, char *out) const {
+	if (n == 0) {
+		return;
+	}
+	if (small()) {
+		std::memcpy(out, inline_ + pos, n);
+		return;
+	}
+	Rep *r = heap_.rep;
+	pos += heap_.offset;
+	if (const char *d = r->data.load(std::memory_order_acquire)) {
+		std::memcpy(out, d + pos, n);
+		return;
+	}
+	// the window may span both halves of the rope.
+	std::size_t ls = r->left.size();
+	if (pos < ls) {
+		std::size_t m = std::min(n, ls - pos);
+		r->left.CopyTo(pos, m, out);
+		out += m;
+		n -= m;
+		pos = ls;
+	}
+	r->right.CopyTo(pos - ls, n, out);
+}
+
+SharedString SharedString::Substr(std::size_t pos, std::size_t n) const {
+	if (pos > size_) {
+		pos = size_;
+	}
+	n = std::min(n, size_ - pos);
+	if (n <= kInline) {
+		SharedString s;
+		s.size_ = n;
+		CopyTo(pos, n, s.inline_);
+		return s;
+	}
+	SharedString s;
+	s.size_ = n;
+	s.heap_.rep = shared_string::Ref(heap_.rep);
+	s.heap_.offset = heap_.offset + pos;
+	return s;
+}
+
+SharedString SharedString::Concat(const SharedString& a, const SharedString& b) {
+	if (a.empty()) {
+		return b;
+	}
+	if (b.empty()) {
+		return a;
+	}
+	std::size_t n = a.size() + b.size();
+	int depth = 1 + std::max(a.small() ? 0 : a.heap_.rep->depth, b.small() ? 0 : b.heap_.rep->depth);
+	if (n < shared_string::kMinRope || depth > shared_string::kMaxDepth) {
+		// short results and deep ropes are copied flat.
+		SharedString s;
+		s.size_ = n;
+		char *out = s.inline_;
+		if (!s.small()) {
+			Rep *r = new Rep(n);
+			out = r->data.load(std::memory_order_relaxed);
+			s.heap_.rep = r;
+			s.heap_.offset = 0;
+		}
+		a.CopyTo(0, a.size(), out);
+		b.CopyTo(0, b.size(), out + a.size());
+		return s;
+	}
+	SharedString s;
+	s.size_ = n;
+	s.heap_.rep = new Rep(a, b, depth);
+	s.heap_.offset = 0;
+	return s;
+}
+
+std::size_t SharedString::Hash() const {
+	// fnv-1a over the characters.
+	uint64_t h = 0xcbf29ce484222325;
+	for (char c: piece()) {
+		h ^= static_cast<uint8_t>(c);
+		h *= 0x100000001b3;
+	}
+	return h;
+}
+
+} // namespace crisp
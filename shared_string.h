@@ -0,0 +1,88 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_SHARED_STRING_H_
+#define CRISP_SHARED_STRING_H_
+
+#include "piece.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace crisp {
+
+namespace shared_string {
+struct Rep;
+} // namespace shared_string
+
+// SharedString is an immutable string that is cheap to copy.
+// short strings are stored inline, longer ones share a reference
+// counted buffer, and substrings share the buffer they were taken from.
+// Concat of long strings builds a rope, flattened once when its
+// characters are first read as a piece. a View shares characters
+// owned elsewhere, such as a mapped file, without copying them.
+class SharedString {
+public:
+	// strings up to this long are stored inline.
+	static const std::size_t kInline = 16;
+
+	SharedString() : size_(0) {}
+	SharedString(StringPiece s);
+	SharedString(const std::string& s) : SharedString(StringPiece(s)) {}
+	SharedString(const char *s) : SharedString(StringPiece(s)) {}
+	SharedString(const SharedString& other);
+	SharedString& operator=(const SharedString& other);
+	~SharedString();
+
+	// returns a string of the characters of s without copying them.
+	// owner keeps them alive until the last string sharing them is gone.
+	static SharedString View(StringPiece s, std::shared_ptr<const void> owner);
+
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	// returns the characters, valid while this string is.
+	StringPiece piece() const;
+	std::string ToString() const { return piece().ToString(); }
+
+	// returns up to n characters from pos, sharing this string's buffer.
+	SharedString Substr(std::size_t pos, std::size_t n = std::string::npos) const;
+	// returns a followed by b.
+	static SharedString Concat(const SharedString& a, const SharedString& b);
+
+	int compare(const SharedString& other) const { return piece().compare(other.piece()); }
+	std::size_t Hash() const;
+private:
+	bool small() const { return size_ <= kInline; }
+	// copies n characters from pos into out without flattening.
+	void CopyTo(std::size_t pos, std::size_t n, char *out) const;
+	friend struct shared_string::Rep;
+
+	struct Heap {
+		shared_string::Rep *rep;
+		std::size_t offset;
+	};
+	union {
+		char inline_[kInline];
+		Heap heap_;
+	};
+	std::size_t size_;
+};
+
+inline bool operator==(const SharedString& a, const SharedString& b) {
+	return a.size() == b.size() && a.compare(b) == 0;
+}
+
+inline bool operator!=(const SharedString& a, const SharedString& b) {
+	return !(a == b);
+}
+
+inline std::ostream& operator<<(std::ostream& os, const SharedString& s) {
+	return os << s.piece();
+}
+
+} // namespace crisp
+
+#endif // CRISP_SHARED_STRING_H_
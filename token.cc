@@ -5,11 +5,13 @@
 
 #include "token.h"
 
+#include <utility>
+
 using namespace crisp;
 
-Token::Token(const enum TokenCategory c, const Position p, const std::string l) : category_(c), pos_(p), lexeme_(l) {}
+Token::Token(const enum TokenCategory c, const Position p, std::string l) : lexeme_(std::move(l)), category_(c), pos_(p) {}
 
-std::string Token::lexeme() const {
+const std::string& Token::lexeme() const {
 	return lexeme_;
 }
 
@@ -28,11 +28,11 @@ public:
 		kPossibleBreak,
 	};
 
-	Token(const enum TokenCategory c, const Position p, const std::string l);
+	Token(const enum TokenCategory c, const Position p, std::string l);
 
 	// returns token as string
 	std::string str() const;
-	std::string lexeme() const;
+	const std::string& lexeme() const;
 	enum TokenCategory category() const;
 	Position pos() const;
 private:
@@ -1,31 +1,350 @@
 
 #include "tree.h"
 #include "functions.h"
+#include "printer.h"
+#include "metrics.h"
+#include "fuel.h"
+#include "heap.h"
+#include "module.h"
+#include <chrono>
+#include <cstring>
 #include <string>
+#include <functional>
+#include <thread>
 
 namespace crisp {
 
-Node::State::State() : symbol_table_(new Scope(nullptr)) {
-	symbol_table_->Put("def", new DefineFunc(this));
-	symbol_table_->Put("lambda", new LambdaFunc(this));
-	symbol_table_->Put("#t", new BooleanNode(true));
-	symbol_table_->Put("#f", new BooleanNode(false));
-	symbol_table_->Put("not", new NotFunc(this));
-	symbol_table_->Put("quote", new QuoteFunc(this));
+namespace {
+
+// seeds distinguishing the hashes of different node kinds.
+enum HashSeed : std::size_t {
+	kNullSeed = 0x9e3779b9,
+	kListSeed = 0x85ebca6b,
+	kErrorSeed = 0xc2b2ae35,
+	kIdentSeed = 0x27d4eb2f,
+	kNumSeed = 0x165667b1,
+	kStringSeed = 0xd3a2646c,
+	kBooleanSeed = 0xfd7046c5,
+	kMapSeed = 0x2545f491,
+	kSetSeed = 0x4f6cdd1d,
+};
+
+std::size_t HashCombine(std::size_t seed, std::size_t h) {
+	return seed ^ (h + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+const char kAllocatedHelp[] = "Nodes allocated, by type.";
+metrics::Counter null_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"null\"");
+metrics::Counter const_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"const\"");
+metrics::Counter callable_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"callable\"");
+metrics::Counter root_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"root\"");
+metrics::Counter list_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"list\"");
+metrics::Counter error_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"error\"");
+metrics::Counter ident_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"ident\"");
+metrics::Counter num_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"num\"");
+metrics::Counter string_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"string\"");
+metrics::Counter boolean_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"boolean\"");
+metrics::Counter map_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"map\"");
+metrics::Counter vlist_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"vlist\"");
+metrics::Counter promise_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"promise\"");
+metrics::Counter seq_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"seq\"");
+metrics::Counter set_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"set\"");
+
+metrics::Counter macro_nodes("crisp_nodes_allocated_total", kAllocatedHelp, "type=\"macro\"");
+metrics::Counter macro_expansions("crisp_macro_expansions_total", "Macro call sites expanded.");
+
+metrics::Counter errors("crisp_errors_total", "Error nodes produced.");
+metrics::Counter lookup_misses("crisp_lookup_misses_total", "Identifiers evaluated that were not bound.");
+metrics::Histogram lookup_depth("crisp_scope_lookup_depth", "Scopes searched by each local lookup.",
+	metrics::Histogram::Exponential(1, 2, 8));
+metrics::Histogram form_latency("crisp_form_eval_seconds", "Time to evaluate each top level form.",
+	metrics::Histogram::Exponential(1000, 4, 12), 1e-9);
+
+} // namespace
+
+Node::State::State() : symbol_table_(new GlobalScope()) {
+	RegisterBuiltins();
+}
+
+namespace {
+
+// builtins hold no state, so one set is shared by every state.
+// they are allocated outside any isolate heap as they outlive them.
+const std::vector<std::pair<std::string, Node *>>& Builtins() {
+	static const std::vector<std::pair<std::string, Node *>> *builtins = []() {
+		Heap::Use global(nullptr);
+		return new std::vector<std::pair<std::string, Node *>>{
+			{"def", new DefineFunc()},
+			{"lambda", new LambdaFunc()},
+			{"not", new NotFunc()},
+			{"quote", new QuoteFunc()},
+			{"+", new AddFunc()},
+			{"-", new SubFunc()},
+			{"*", new MulFunc()},
+			{"pmap", new PMapFunc()},
+			{"pfor", new PForFunc()},
+			{"preduce", new PReduceFunc()},
+			{"future", new FutureFunc()},
+			{"touch", new TouchFunc()},
+			{"spawn", new SpawnFunc()},
+			{"make-chan", new MakeChanFunc()},
+			{"send", new SendFunc()},
+			{"recv", new RecvFunc()},
+			{"select", new SelectFunc()},
+			{"hash-map", new HashMapFunc()},
+			{"hash-set", new HashSetFunc()},
+			{"assoc", new AssocFunc()},
+			{"dissoc", new DissocFunc()},
+			{"get", new GetFunc()},
+			{"contains", new ContainsFunc()},
+			{"keys", new MapListFunc(MapListFunc::kKeys)},
+			{"vals", new MapListFunc(MapListFunc::kValues)},
+			{"entries", new MapListFunc(MapListFunc::kEntries)},
+			{"list", new ListFunc()},
+			{"car", new CarFunc()},
+			{"cdr", new CdrFunc()},
+			{"cons", new ConsFunc()},
+			{"append", new AppendFunc()},
+			{"length", new LengthFunc()},
+			{"concat", new ConcatFunc()},
+			{"substring", new SubstringFunc()},
+			{"compare", new CompareFunc()},
+			{"defmacro", new DefmacroFunc()},
+			{"gensym", new GensymFunc()},
+			{"require", new RequireFunc()},
+			{"delay", new DelayFunc()},
+			{"force", new ForceFunc()},
+			{"range", new RangeFunc()},
+			{"lazy-map", new SeqStageFunc(SeqNode::Stage::kMap)},
+			{"lazy-filter", new SeqStageFunc(SeqNode::Stage::kFilter)},
+			{"take", new SeqStageFunc(SeqNode::Stage::kTake)},
+			{"drop", new SeqStageFunc(SeqNode::Stage::kDrop)},
+			{"read-file", new ReadFileFunc()},
+			{"lines", new LinesFunc()},
+			{"write", new WriteFunc()},
+			{"#t", new BooleanNode(true)},
+			{"#f", new BooleanNode(false)},
+		};
+	}();
+	return *builtins;
+}
+
+} // namespace
+
+void Node::State::RegisterBuiltins() {
+	for (auto& b : Builtins()) {
+		symbol_table_->Put(b.first, b.second);
+	}
+	// memo keeps its caches by expression, so each state gets its own.
+	symbol_table_->Put("memo", new MemoFunc());
+}
+
+Node *Scope::Get(std::string str) {
+	// nested scopes are searched iteratively so the depth can be recorded.
+	Scope *s = this;
+	for (uint64_t depth = 1; ; depth++) {
+		auto i = s->table.find(str);
+		if (i != s->table.end() && i->second != nullptr) {
+			lookup_depth.Observe(depth);
+			return i->second;
+		}
+		Scope *p = dynamic_cast<Scope *>(s->parent);
+		if (p == nullptr) {
+			lookup_depth.Observe(depth);
+			return s->parent != nullptr ? s->parent->Get(str) : nullptr;
+		}
+		s = p;
+	}
 }
 
 std::string Scope::PPrint() const {
-	std::string s;
-	for (auto i = table.begin(); i != table.end(); i++) {
-		s += (*i).first + ": ";
-		if ((*i).second != nullptr) {
-			s += (*i).second->PPrint();
+	std::ostringstream os;
+	Printer(&os).PrintBindings(table);
+	return os.str();
+}
+
+std::size_t Node::Hash() const {
+	return std::hash<const Node *>()(this);
+}
+
+bool Node::Equal(const Node *other) const {
+	return this == other;
+}
+
+namespace {
+
+const std::size_t kInitialBuckets = 64;
+// retired bindings a writer lets pile up before it waits for readers.
+const std::size_t kReclaimThreshold = 256;
+
+thread_local ScopeObserver *current_observer = nullptr;
+
+} // namespace
+
+ScopeObserver *ScopeObserver::Current() {
+	return current_observer;
+}
+
+ScopeObserver::Use::Use(ScopeObserver *observer) : prev(current_observer) {
+	current_observer = observer;
+}
+
+ScopeObserver::Use::~Use() {
+	current_observer = prev;
+}
+
+GlobalScope::Table::Table(std::size_t n) : size(n), buckets(new std::atomic<const Binding *>[n]) {
+	for (std::size_t i = 0; i < n; i++) {
+		buckets[i].store(nullptr, std::memory_order_relaxed);
+	}
+}
+
+GlobalScope::Table::~Table() {
+	delete[] buckets;
+}
+
+GlobalScope::Guard::Guard(const GlobalScope *s) {
+	std::size_t stripe = std::hash<std::thread::id>()(std::this_thread::get_id()) % kStripes;
+	for (;;) {
+		unsigned phase = s->phase_.load(std::memory_order_seq_cst);
+		count = &s->readers_[stripe].count[phase & 1];
+		count->fetch_add(1, std::memory_order_seq_cst);
+		// a reclaim may have flipped the phase and drained its counter
+		// before the add, the reader then counts under the new phase.
+		if (s->phase_.load(std::memory_order_seq_cst) == phase) {
+			return;
+		}
+		count->fetch_sub(1, std::memory_order_release);
+	}
+}
+
+GlobalScope::Guard::~Guard() {
+	count->fetch_sub(1, std::memory_order_release);
+}
+
+GlobalScope::GlobalScope() : table_(new Table(kInitialBuckets)) {}
+
+GlobalScope::~GlobalScope() {
+	Table *t = table_.load();
+	for (std::size_t i = 0; i < t->size; i++) {
+		for (const Binding *b = t->buckets[i].load(); b != nullptr;) {
+			const Binding *next = b->next;
+			delete b;
+			b = next;
+		}
+	}
+	delete t;
+	for (auto i: retired_bindings) {
+		delete i;
+	}
+	for (auto i: retired_tables) {
+		delete i;
+	}
+}
+
+Node *GlobalScope::Get(std::string str) {
+	ScopeObserver *o = ScopeObserver::Current();
+	if (o != nullptr && o->scope() == this) {
+		o->Read(str);
+	}
+	{
+		Guard guard(this);
+		const Table *t = table();
+		std::size_t h = std::hash<std::string>()(str) % t->size;
+		for (const Binding *b = t->buckets[h].load(std::memory_order_acquire); b != nullptr; b = b->next) {
+			if (b->name == str) {
+				return b->node;
+			}
+		}
+	}
+	Node::State::SymbolTableInterface *f = fallback_.load(std::memory_order_acquire);
+	return f != nullptr ? f->Get(str) : nullptr;
+}
+
+void GlobalScope::Put(std::string str, Node *node) {
+	ScopeObserver *o = ScopeObserver::Current();
+	if (o != nullptr && o->scope() == this) {
+		o->Wrote(str);
+	}
+	std::lock_guard<std::mutex> lock(mut);
+	Table *t = table_.load(std::memory_order_relaxed);
+	std::atomic<const Binding *>& bucket = t->buckets[std::hash<std::string>()(str) % t->size];
+
+	// copy the chain, replacing any previous binding.
+	const Binding *old = bucket.load(std::memory_order_relaxed);
+	const Binding *chain = new Binding{str, node, nullptr};
+	bool replaced = false;
+	for (const Binding *b = old; b != nullptr; b = b->next) {
+		if (b->name == str) {
+			replaced = true;
 		} else {
-			s += "null";
+			chain = new Binding{b->name, b->node, chain};
 		}
-		s += '\n';
+		retired_bindings.push_back(b);
 	}
-	return s;
+	bucket.store(chain, std::memory_order_release);
+
+	if (!replaced && ++count > 2 * t->size) {
+		Grow();
+	}
+	if (retired_bindings.size() >= kReclaimThreshold) {
+		Reclaim();
+	}
+}
+
+void GlobalScope::Grow() {
+	Table *old = table_.load(std::memory_order_relaxed);
+	Table *t = new Table(old->size * 2);
+	for (std::size_t i = 0; i < old->size; i++) {
+		for (const Binding *b = old->buckets[i].load(std::memory_order_relaxed); b != nullptr; b = b->next) {
+			std::atomic<const Binding *>& bucket = t->buckets[std::hash<std::string>()(b->name) % t->size];
+			bucket.store(new Binding{b->name, b->node, bucket.load(std::memory_order_relaxed)}, std::memory_order_relaxed);
+			retired_bindings.push_back(b);
+		}
+	}
+	table_.store(t, std::memory_order_release);
+	retired_tables.push_back(old);
+}
+
+void GlobalScope::Reclaim() {
+	// readers that start after the flip count under the new phase and can
+	// only reach the published snapshot, so only the old phase must drain.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned phase = phase_.fetch_add(1, std::memory_order_seq_cst) & 1;
+	for (std::size_t i = 0; i < kStripes;) {
+		if (readers_[i].count[phase].load(std::memory_order_seq_cst) != 0) {
+			std::this_thread::yield();
+		} else {
+			i++;
+		}
+	}
+	for (auto i: retired_bindings) {
+		delete i;
+	}
+	for (auto i: retired_tables) {
+		delete i;
+	}
+	retired_bindings.clear();
+	retired_tables.clear();
+}
+
+std::map<std::string, Node *> GlobalScope::Bindings() const {
+	std::map<std::string, Node *> sorted;
+	Guard guard(this);
+	const Table *t = table();
+	for (std::size_t i = 0; i < t->size; i++) {
+		for (const Binding *b = t->buckets[i].load(std::memory_order_acquire); b != nullptr; b = b->next) {
+			sorted[b->name] = b->node;
+		}
+	}
+	return sorted;
+}
+
+std::string GlobalScope::PPrint() const {
+	// print in name order, as Scope does.
+	std::ostringstream os;
+	Printer(&os).PrintBindings(Bindings());
+	return os.str();
 }
 
 bool Node::isTrue() {
@@ -34,6 +353,10 @@ bool Node::isTrue() {
 	return b == nullptr || b->value() == true;
 }
 
+NullNode::NullNode() {
+	null_nodes.Inc();
+}
+
 Node *NullNode::Eval(State *state) const {
 	return const_cast<NullNode *>(this); // evalutate to self
 }
@@ -43,10 +366,22 @@ std::string NullNode::PPrint() const {
 	return "()";
 }
 
+std::size_t NullNode::Hash() const {
+	return kNullSeed;
+}
+
+bool NullNode::Equal(const Node *other) const {
+	return dynamic_cast<const NullNode *>(other) != nullptr;
+}
+
 void ParentNode::Put(Node *node) {
 	children_.push_back(node);
 }
 
+ConstNode::ConstNode() {
+	const_nodes.Inc();
+}
+
 std::string ConstNode::PPrint() const {
 	return std::string("'") + child->PPrint();
 }
@@ -55,15 +390,31 @@ void ConstNode::Put(Node *node) {
 	child = node;
 }
 
+CallableNode::CallableNode() {
+	callable_nodes.Inc();
+}
+
 Node *CallableNode::Eval(State *state) const {
 	// callable nodes evaluate to themselves.
 	return const_cast<CallableNode *>(this);
 }
 
+RootNode::RootNode() {
+	root_nodes.Inc();
+}
+
 Node *RootNode::Eval(State *state) const {
 	RootNode *root = new RootNode(); // copy self
+	bool timed = metrics::Registry::Default()->enabled();
 	for (auto i: children_) {
+		if (!timed) {
+			root->Put(i->Eval(state));
+			continue;
+		}
+		auto start = std::chrono::steady_clock::now();
 		root->Put(i->Eval(state));
+		form_latency.Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
 	}
 	return root;
 }
@@ -73,9 +424,13 @@ void RootNode::Put(Node *node) {
 }
 
 std::string RootNode::PPrint() const {
-	std::string s;
-	for (auto i: children_) { s += i->PPrint() + " "; }
-	return s;
+	std::ostringstream os;
+	Printer(&os).Print(this);
+	return os.str();
+}
+
+ListNode::ListNode() {
+	list_nodes.Inc();
 }
 
 Node *ListNode::Eval(State *state) const {
@@ -84,11 +439,27 @@ Node *ListNode::Eval(State *state) const {
 	if (children_.begin() != children_.end()) {
 		// assure first atom is callable
 		Node *callNode = (*children_.begin())->Eval(state);
+		if (auto macro = dynamic_cast<MacroNode *>(callNode)) {
+			return Expand(macro)->Eval(state);
+		}
 		if (dynamic_cast<CallableNode *>(callNode) != nullptr) {
+			// each call is a step of a metered evaluation.
+			Meter *meter = Meter::Current();
+			if (meter != nullptr && !meter->Step()) {
+				return new ErrorNode(meter->failure());
+			}
 			// execute call
 			// create a vector of parameters.
 			std::vector<Node *> params(children_.begin() + 1, children_.end());
-			return static_cast<CallableNode *>(callNode)->Call(params);
+			// calls are named by the identifier they were called through,
+			// anonymous callables by their printed form. lambdas record
+			// a frame of their own however they are called.
+			IdentNode *ident = Profiler::enabled() ? dynamic_cast<IdentNode *>(*children_.begin()) : nullptr;
+			if (Profiler::enabled() && (ident != nullptr || dynamic_cast<LambdaFunc::Instance *>(callNode) == nullptr)) {
+				Profiler::Frame frame(ident != nullptr ? ident->PPrint() : callNode->PPrint());
+				return static_cast<CallableNode *>(callNode)->Call(state, params);
+			}
+			return static_cast<CallableNode *>(callNode)->Call(state, params);
 		} else {
 			return new ErrorNode(std::string("List: first atom must be Callable not '") + callNode->PPrint() + "'");
 		}
@@ -98,28 +469,79 @@ Node *ListNode::Eval(State *state) const {
 	}
 }
 
+ListNode::~ListNode() {
+	const Expansion *e = expansion_.load(std::memory_order_acquire);
+	while (e != nullptr) {
+		const Expansion *replaced = e->replaced;
+		delete e;
+		e = replaced;
+	}
+}
+
+Node *ListNode::Expand(const MacroNode *macro) const {
+	const Expansion *e = expansion_.load(std::memory_order_acquire);
+	if (e != nullptr && e->macro == macro) {
+		return e->tree;
+	}
+	// the expansion is kept with the call site, so it is allocated
+	// from the call site's heap and not one that may be freed first.
+	Heap::Use use(Heap::Owns(this) ? Heap::Current() : nullptr);
+	std::vector<Node *> args(children_.begin() + 1, children_.end());
+	Node *tree = macro->Expand(args);
+	if (dynamic_cast<ErrorNode *>(tree) != nullptr) {
+		// errors may depend on definitions made later, do not keep them.
+		return tree;
+	}
+	// a racing expansion of the same site may be kept instead.
+	auto expansion = new Expansion{macro, tree, e};
+	if (!expansion_.compare_exchange_strong(e, expansion, std::memory_order_acq_rel)) {
+		delete expansion;
+	}
+	return tree;
+}
+
 void ListNode::Put(Node *node) {
 	children_.push_back(node);
 }
 
 std::string ListNode::PPrint() const {
-	std::string s;
-	s += "(";
-	for (auto i = children_.begin(); i != children_.end(); i++) {
-		if (i != children_.begin()) {
-			s += " ";
-		}
-		if (*i != nullptr) {
-			s += (*i)->PPrint();
-		} else {
-			s += "null";
+	std::ostringstream os;
+	Printer(&os).Print(this);
+	return os.str();
+}
+
+std::size_t ListNode::Hash() const {
+	std::size_t h = kListSeed;
+	for (auto i: children_) {
+		h = HashCombine(h, i != nullptr ? i->Hash() : 0);
+	}
+	return h;
+}
+
+bool ListNode::Equal(const Node *other) const {
+	if (this == other) {
+		return true;
+	}
+	if (dynamic_cast<const VListNode *>(other) != nullptr) {
+		return other->Equal(this);
+	}
+	auto l = dynamic_cast<const ListNode *>(other);
+	if (l == nullptr || l->children_.size() != children_.size()) {
+		return false;
+	}
+	for (std::size_t i = 0; i < children_.size(); i++) {
+		const Node *a = children_[i], *b = l->children_[i];
+		if (a != b && (a == nullptr || b == nullptr || !a->Equal(b))) {
+			return false;
 		}
 	}
-	s += ")";
-	return s;
+	return true;
 }
 
-ErrorNode::ErrorNode(std::string msg) : msg_(msg) {}
+ErrorNode::ErrorNode(std::string msg) : msg_(msg) {
+	error_nodes.Inc();
+	errors.Inc();
+}
 
 Node *ErrorNode::Eval(State *state) const {
 	return const_cast<ErrorNode *>(this); // error nodes evaluate to themselves
@@ -129,19 +551,49 @@ std::string ErrorNode::PPrint() const {
 	return std::string("Error: ") + msg_;
 }
 
-IdentNode::IdentNode(std::string id) : str_(id) {}
+std::size_t ErrorNode::Hash() const {
+	return HashCombine(kErrorSeed, std::hash<std::string>()(msg_));
+}
+
+bool ErrorNode::Equal(const Node *other) const {
+	auto e = dynamic_cast<const ErrorNode *>(other);
+	return e != nullptr && e->msg_ == msg_;
+}
+
+IdentNode::IdentNode(std::string id) : str_(id) {
+	ident_nodes.Inc();
+}
 
 Node *IdentNode::Eval(State *state) const {
 	// lookup in symbol table
 	Node *def = state->symbol_table()->Get(str_);
-	return def == nullptr ? new ErrorNode(std::string("variable '") + str() + "' is undefined") : def->Eval(state);
+	if (def == nullptr) {
+		// module/symbol is evaluated in the module's namespace.
+		if (Node *n = LookupQualified(state, str_)) {
+			return n;
+		}
+		lookup_misses.Inc();
+		return new ErrorNode(std::string("variable '") + str() + "' is undefined");
+	}
+	return def->Eval(state);
 }
 
 std::string IdentNode::PPrint() const {
 	return str();
 }
 
-NumNode::NumNode(int n) : num(n) {}
+std::size_t IdentNode::Hash() const {
+	return HashCombine(kIdentSeed, std::hash<std::string>()(str_));
+}
+
+bool IdentNode::Equal(const Node *other) const {
+	auto i = dynamic_cast<const IdentNode *>(other);
+	return i != nullptr && i->str_ == str_;
+}
+
+NumNode::NumNode(int n) : num_(n) {
+	num_nodes.Inc();
+}
 
 Node *NumNode::Eval(State *state) const {
 	return const_cast<NumNode *>(this); // num nodes evaluate to themselves
@@ -149,21 +601,43 @@ Node *NumNode::Eval(State *state) const {
 
 std::string NumNode::PPrint() const {
 	std::stringstream os;
-	os << num;
+	os << num_;
 	return os.str();
 }
 
-StringNode::StringNode(std::string str) : str_(str) {}
+std::size_t NumNode::Hash() const {
+	return HashCombine(kNumSeed, std::hash<int>()(num_));
+}
+
+bool NumNode::Equal(const Node *other) const {
+	auto n = dynamic_cast<const NumNode *>(other);
+	return n != nullptr && n->num_ == num_;
+}
+
+StringNode::StringNode(SharedString str) : str_(str) {
+	string_nodes.Inc();
+}
 
 Node *StringNode::Eval(State *state) const {
 	return const_cast<StringNode *>(this); // string nodes evaluate to themselves
 }
 
 std::string StringNode::PPrint() const {
-	return std::string("\"") + str() + "\"";
+	return std::string("\"") + str_.ToString() + "\"";
+}
+
+std::size_t StringNode::Hash() const {
+	return HashCombine(kStringSeed, str_.Hash());
 }
 
-BooleanNode::BooleanNode(bool val) : value_(val) {}
+bool StringNode::Equal(const Node *other) const {
+	auto s = dynamic_cast<const StringNode *>(other);
+	return s != nullptr && s->str_ == str_;
+}
+
+BooleanNode::BooleanNode(bool val) : value_(val) {
+	boolean_nodes.Inc();
+}
 
 Node *BooleanNode::Eval(State *state) const {
 	return const_cast<BooleanNode *>(this); // boolean evaluates to itself
@@ -173,4 +647,409 @@ std::string BooleanNode::PPrint() const {
 	return value_ ? "#t" : "#f";
 }
 
+std::size_t BooleanNode::Hash() const {
+	return HashCombine(kBooleanSeed, value_);
+}
+
+bool BooleanNode::Equal(const Node *other) const {
+	auto b = dynamic_cast<const BooleanNode *>(other);
+	return b != nullptr && b->value_ == value_;
+}
+
+MapNode::MapNode(Hamt map) : map_(map) {
+	map_nodes.Inc();
+}
+
+Node *MapNode::Eval(State *state) const {
+	return const_cast<MapNode *>(this); // maps evaluate to themselves
+}
+
+std::string MapNode::PPrint() const {
+	std::string s = "{map";
+	map_.ForEach([&](Node *k, Node *v) {
+		s += " (" + k->PPrint() + " " + v->PPrint() + ")";
+	});
+	return s + "}";
+}
+
+std::size_t MapNode::Hash() const {
+	// bindings are combined without regard to order,
+	// equal maps may keep them in different orders.
+	std::size_t h = kMapSeed;
+	map_.ForEach([&](Node *k, Node *v) {
+		h += HashCombine(k->Hash(), v->Hash());
+	});
+	return h;
+}
+
+bool MapNode::Equal(const Node *other) const {
+	auto m = dynamic_cast<const MapNode *>(other);
+	if (m == nullptr || m->map_.size() != map_.size()) {
+		return false;
+	}
+	bool equal = true;
+	map_.ForEach([&](Node *k, Node *v) {
+		Node *o = m->map_.Get(k);
+		equal = equal && o != nullptr && (o == v || o->Equal(v));
+	});
+	return equal;
+}
+
+SetNode::SetNode(Hamt set) : set_(set) {
+	set_nodes.Inc();
+}
+
+Node *SetNode::Eval(State *state) const {
+	return const_cast<SetNode *>(this); // sets evaluate to themselves
+}
+
+std::string SetNode::PPrint() const {
+	std::string s = "{set";
+	set_.ForEach([&](Node *k, Node *v) {
+		s += " " + k->PPrint();
+	});
+	return s + "}";
+}
+
+std::size_t SetNode::Hash() const {
+	std::size_t h = kSetSeed;
+	set_.ForEach([&](Node *k, Node *v) {
+		h += k->Hash();
+	});
+	return h;
+}
+
+bool SetNode::Equal(const Node *other) const {
+	auto s = dynamic_cast<const SetNode *>(other);
+	if (s == nullptr || s->set_.size() != set_.size()) {
+		return false;
+	}
+	bool equal = true;
+	set_.ForEach([&](Node *k, Node *v) {
+		equal = equal && s->set_.Get(k) != nullptr;
+	});
+	return equal;
+}
+
+VListNode::VListNode(VList list) : list_(list) {
+	vlist_nodes.Inc();
+}
+
+Node *VListNode::Eval(State *state) const {
+	return const_cast<VListNode *>(this); // list values evaluate to themselves
+}
+
+std::string VListNode::PPrint() const {
+	std::string s = "(";
+	bool first = true;
+	list_.ForEach([&](Node *n) {
+		if (!first) {
+			s += " ";
+		}
+		s += n->PPrint();
+		first = false;
+	});
+	return s + ")";
+}
+
+std::size_t VListNode::Hash() const {
+	std::size_t h = kListSeed;
+	list_.ForEach([&](Node *n) {
+		h = HashCombine(h, n != nullptr ? n->Hash() : 0);
+	});
+	return h;
+}
+
+bool VListNode::Equal(const Node *other) const {
+	if (this == other) {
+		return true;
+	}
+	std::vector<Node *> items;
+	if (auto v = dynamic_cast<const VListNode *>(other)) {
+		if (v->list_.size() != list_.size()) {
+			return false;
+		}
+		items = v->list_.ToVector();
+	} else if (auto l = dynamic_cast<const ListNode *>(other)) {
+		items = l->children();
+	} else {
+		return false;
+	}
+	if (items.size() != list_.size()) {
+		return false;
+	}
+	std::size_t i = 0;
+	bool equal = true;
+	list_.ForEach([&](Node *a) {
+		Node *b = items[i++];
+		equal = equal && (a == b || (a != nullptr && b != nullptr && a->Equal(b)));
+	});
+	return equal;
+}
+
+PromiseNode::PromiseNode(Node *exp, State *state) : exp_(exp), state_(state) {
+	promise_nodes.Inc();
+}
+
+Node *PromiseNode::Eval(State *state) const {
+	return const_cast<PromiseNode *>(this); // promises evaluate to themselves
+}
+
+std::string PromiseNode::PPrint() const {
+	Node *value = value_.load(std::memory_order_acquire);
+	return value != nullptr ? value->PPrint() : "{promise}";
+}
+
+Node *PromiseNode::Force() {
+	// the promises passed through on the way to the value.
+	std::vector<PromiseNode *> chain;
+	PromiseNode *p = this;
+	Node *value;
+	for (;;) {
+		value = p->value_.load(std::memory_order_acquire);
+		if (value != nullptr) {
+			break;
+		}
+		chain.push_back(p);
+		value = p->exp_->Eval(p->state_);
+		auto next = dynamic_cast<PromiseNode *>(value);
+		if (next == nullptr) {
+			break;
+		}
+		if (next == p) {
+			return new ErrorNode("promise yields itself");
+		}
+		p = next;
+	}
+	if (dynamic_cast<ErrorNode *>(value) != nullptr) {
+		// errors may depend on definitions made later.
+		return value;
+	}
+	for (auto i: chain) {
+		// a racing force may have stored its value first.
+		Node *expected = nullptr;
+		i->value_.compare_exchange_strong(expected, value, std::memory_order_acq_rel);
+	}
+	return value_.load(std::memory_order_acquire);
+}
+
+SeqNode::SeqNode() {
+	seq_nodes.Inc();
+}
+
+SeqNode *SeqNode::Range(long start, long end, long step, bool bounded) {
+	SeqNode *s = new SeqNode();
+	s->source_ = kRange;
+	s->start_ = start;
+	s->end_ = end;
+	s->step_ = step;
+	s->bounded_ = bounded;
+	return s;
+}
+
+SeqNode *SeqNode::Of(VList list) {
+	SeqNode *s = new SeqNode();
+	s->source_ = kList;
+	s->list_ = list;
+	return s;
+}
+
+SeqNode *SeqNode::Lines(SharedString text) {
+	SeqNode *s = new SeqNode();
+	s->source_ = kLines;
+	s->text_ = text;
+	return s;
+}
+
+SeqNode *SeqNode::With(Stage stage) const {
+	SeqNode *s = new SeqNode(*this);
+	if (stage.kind != Stage::kDrop) {
+		s->stages_.push_back(stage);
+	} else if (stage.n <= 0) {
+		// dropping nothing leaves the sequence as it is.
+	} else if (!stages_.empty() && stages_.back().kind == Stage::kDrop) {
+		// repeated drops, as from cdr, merge into one stage.
+		s->stages_.back().n += stage.n;
+	} else if (!stages_.empty()) {
+		s->stages_.push_back(stage);
+	} else if (source_ == kRange) {
+		// with no stages the source itself is advanced.
+		s->start_ += stage.n * step_;
+		if (bounded_ && (step_ > 0 ? s->start_ > end_ : s->start_ < end_)) {
+			s->start_ = end_;
+		}
+	} else if (source_ == kList) {
+		for (long i = 0; i < stage.n && !s->list_.empty(); i++) {
+			s->list_ = s->list_.Rest();
+		}
+	} else {
+		StringPiece text = text_.piece();
+		std::size_t offset = 0;
+		for (long i = 0; i < stage.n && offset < text.size(); i++) {
+			auto nl = static_cast<const char *>(memchr(text.data() + offset, '\n', text.size() - offset));
+			offset = nl != nullptr ? nl - text.data() + 1 : text.size();
+		}
+		s->text_ = text_.Substr(offset);
+	}
+	return s;
+}
+
+Node *SeqNode::ForEach(State *state, const std::function<bool(Node *)>& fn) const {
+	// elements taken or dropped so far by each stage.
+	std::vector<long> counts(stages_.size(), 0);
+	for (auto& i: stages_) {
+		if (i.kind == Stage::kTake && i.n <= 0) {
+			return nullptr;
+		}
+	}
+
+	Meter *meter = Meter::Current();
+	long next = start_;
+	VList rest = list_;
+	// the characters are read in place, each line is a substring.
+	StringPiece text = source_ == kLines ? text_.piece() : StringPiece();
+	std::size_t offset = 0;
+	for (;;) {
+		// each element is a step of a metered evaluation,
+		// so infinite sequences can be cancelled.
+		if (meter != nullptr && !meter->Step()) {
+			return new ErrorNode(meter->failure());
+		}
+
+		Node *item;
+		if (source_ == kRange) {
+			if (bounded_ && (step_ > 0 ? next >= end_ : next <= end_)) {
+				return nullptr;
+			}
+			item = new NumNode(next);
+			next += step_;
+		} else if (source_ == kList) {
+			if (rest.empty()) {
+				return nullptr;
+			}
+			item = rest.First();
+			rest = rest.Rest();
+		} else {
+			if (offset == text.size()) {
+				return nullptr;
+			}
+			auto nl = static_cast<const char *>(memchr(text.data() + offset, '\n', text.size() - offset));
+			std::size_t end = nl != nullptr ? nl - text.data() : text.size();
+			item = new StringNode(text_.Substr(offset, end - offset));
+			offset = nl != nullptr ? end + 1 : end;
+		}
+
+		bool keep = true, last = false;
+		for (std::size_t i = 0; i < stages_.size() && keep; i++) {
+			const Stage& stage = stages_[i];
+			switch (stage.kind) {
+			case Stage::kMap:
+			case Stage::kFilter: {
+				std::vector<Node *> args = {Quoted(item)};
+				Node *result = stage.func->Call(state, args);
+				if (dynamic_cast<ErrorNode *>(result) != nullptr) {
+					return result;
+				}
+				if (stage.kind == Stage::kMap) {
+					item = result;
+				} else {
+					keep = result->isTrue();
+				}
+				break;
+			}
+			case Stage::kTake:
+				// the element reaching the limit is the last one.
+				last = last || ++counts[i] == stage.n;
+				break;
+			case Stage::kDrop:
+				if (counts[i] < stage.n) {
+					counts[i]++;
+					keep = false;
+				}
+				break;
+			}
+		}
+		if (keep && !fn(item)) {
+			return nullptr;
+		}
+		if (last) {
+			return nullptr;
+		}
+	}
+}
+
+Node *SeqNode::Eval(State *state) const {
+	return const_cast<SeqNode *>(this); // sequences evaluate to themselves
+}
+
+std::string SeqNode::PPrint() const {
+	return "{seq}";
+}
+
+namespace {
+
+// returns the code a macro body returned as a syntax tree,
+// list values become lists to be evaluated.
+Node *Syntax(Node *value) {
+	std::vector<Node *> items;
+	if (auto v = dynamic_cast<VListNode *>(value)) {
+		items = v->list().ToVector();
+	} else if (auto l = dynamic_cast<ListNode *>(value)) {
+		items = l->children();
+	} else {
+		return value;
+	}
+	bool changed = dynamic_cast<ListNode *>(value) == nullptr;
+	for (auto& i: items) {
+		Node *n = Syntax(i);
+		changed = changed || n != i;
+		i = n;
+	}
+	if (!changed) {
+		return value;
+	}
+	auto list = new ListNode();
+	for (auto i: items) {
+		list->Put(i);
+	}
+	return list;
+}
+
+} // namespace
+
+MacroNode::MacroNode(std::string name, std::vector<std::string> params, Node *body, State::SymbolTableInterface *scope)
+	: name_(name), params_(params), body_(body), scope_(scope) {
+	macro_nodes.Inc();
+}
+
+Node *MacroNode::Eval(State *state) const {
+	return const_cast<MacroNode *>(this); // macros evaluate to themselves
+}
+
+std::string MacroNode::PPrint() const {
+	return "{macro " + name_ + "}";
+}
+
+Node *MacroNode::Expand(const std::vector<Node *>& args) const {
+	if (args.size() != params_.size()) {
+		return new ErrorNode(PPrint() + " takes " + std::to_string(params_.size()) + " atoms not " + std::to_string(args.size()));
+	}
+	macro_expansions.Inc();
+	auto scope = new Scope(scope_);
+	for (std::size_t i = 0; i < args.size(); i++) {
+		scope->Put(params_[i], Quoted(args[i]));
+	}
+	State state(scope);
+	return Syntax(body_->Eval(&state));
+}
+
+Node *Quoted(Node *value) {
+	if (dynamic_cast<ListNode *>(value) == nullptr && dynamic_cast<IdentNode *>(value) == nullptr) {
+		return value;
+	}
+	auto c = new ConstNode();
+	c->Put(value);
+	return c;
+}
+
 } // namespace
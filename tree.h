@@ -6,16 +6,28 @@
 #ifndef CRISP_TREE_H_
 #define CRISP_TREE_H_
 
+#include "hamt.h"
+#include "heap.h"
+#include "profile.h"
+#include "shared_string.h"
+#include "vlist.h"
 #include "token.h"
 
+#include <atomic>
+#include <cstddef>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <sstream>
 
 namespace crisp {
 
-class Node {
+// nodes are allocated from the calling thread's current heap.
+class Node : public HeapObject {
 public:
+	Node() { node_allocations++; }
 	virtual ~Node() {}
 
 	class State {
@@ -35,6 +47,9 @@ public:
 		SymbolTableInterface *symbol_table() {
 			return symbol_table_;
 		}
+
+		// binds the builtins, shared by every state, in its symbol table.
+		void RegisterBuiltins();
 	private:
 		SymbolTableInterface *symbol_table_;
 	};
@@ -46,37 +61,151 @@ public:
 	// returns the result of evaluating itself
 	virtual Node *Eval(State *state) const = 0;
 
+	// returns a structural hash of this node,
+	// nodes that are Equal hash to the same value.
+	virtual std::size_t Hash() const;
+
+	// returns true if other is structurally equal to this node,
+	// by default nodes are only equal to themselves.
+	virtual bool Equal(const Node *other) const;
+
 	// NOTE: helper functions.
 
 	bool isTrue();
 
 };
 
-class Scope : public Node::State::SymbolTableInterface {
+// scopes of calls are allocated from the current heap, as their nodes are.
+class Scope : public HeapObject, public Node::State::SymbolTableInterface {
 public:
 	Scope(Node::State::SymbolTableInterface *s) : parent(s) {}
 	virtual void Put(std::string str, Node *node) {
 		table[str] = node;
 	}
-	virtual Node *Get(std::string str) {
-		Node *n = [&]()->Node* {
-			try {
-				return table.at(str);
-			} catch (...) {
-				return nullptr;
-			}
-		}();
-		return n ? n : (parent ? parent->Get(str) : nullptr);
-	}
+	virtual Node *Get(std::string str);
 	virtual std::string PPrint() const;
 private:
 	Node::State::SymbolTableInterface *parent;
 };
 
+class GlobalScope;
+
+// ScopeObserver is told of the names looked up and bound in a
+// GlobalScope by the evaluation it is current for. it is current on a
+// thread for the lifetime of a Use, and fibers and futures started
+// meanwhile keep it while they run, so it must be owned by a shared_ptr.
+class ScopeObserver : public std::enable_shared_from_this<ScopeObserver> {
+public:
+	explicit ScopeObserver(const GlobalScope *scope) : scope_(scope) {}
+	virtual ~ScopeObserver() {}
+
+	// called for every lookup, including those that miss.
+	virtual void Read(const std::string& name) = 0;
+	virtual void Wrote(const std::string& name) = 0;
+
+	const GlobalScope *scope() const { return scope_; }
+
+	// returns the observer current on this thread, or nullptr.
+	static ScopeObserver *Current();
+
+	// Use makes an observer current for its lifetime. uses nest.
+	class Use {
+	public:
+		explicit Use(ScopeObserver *observer);
+		~Use();
+	private:
+		ScopeObserver *prev;
+	};
+private:
+	const GlobalScope *scope_;
+};
+
+// symbol table of global definitions, shared by evaluator threads.
+// Get reads an immutable snapshot without locking. Put is serialized,
+// it publishes a copy of the bucket it changes and retires the old one,
+// which is freed once the readers that may still hold it have left.
+class GlobalScope : public Node::State::SymbolTableInterface {
+public:
+	GlobalScope();
+	~GlobalScope();
+
+	// deleted copy and move constructor.
+	GlobalScope(const GlobalScope&) = delete;
+	GlobalScope(GlobalScope&&) = delete;
+
+	virtual void Put(std::string str, Node *node);
+	virtual Node *Get(std::string str);
+	virtual std::string PPrint() const;
+
+	// returns a snapshot of the bindings in name order.
+	std::map<std::string, Node *> Bindings() const;
+
+	// sets a table consulted for names that are not bound here.
+	void set_fallback(Node::State::SymbolTableInterface *s) {
+		fallback_.store(s, std::memory_order_release);
+	}
+	Node::State::SymbolTableInterface *fallback() const {
+		return fallback_.load(std::memory_order_acquire);
+	}
+private:
+	struct Binding {
+		std::string name;
+		Node *node;
+		const Binding *next;
+	};
+	struct Table {
+		Table(std::size_t n);
+		~Table();
+		std::size_t size;
+		std::atomic<const Binding *> *buckets;
+	};
+
+	// Guard marks a reader walking a snapshot. readers count themselves
+	// under the current phase; a writer flips the phase and waits for the
+	// old one to drain, after which nothing it retired is reachable.
+	class Guard {
+	public:
+		explicit Guard(const GlobalScope *s);
+		~Guard();
+	private:
+		std::atomic<long> *count;
+	};
+	static const std::size_t kStripes = 16;
+	struct Readers {
+		std::atomic<long> count[2];
+		char pad[64 - 2 * sizeof(std::atomic<long>)];
+	};
+
+	// returns the current snapshot, must hold a Guard or mut.
+	const Table *table() const {
+		return table_.load(std::memory_order_acquire);
+	}
+	// rehashes into a larger table, must hold mut.
+	void Grow();
+	// frees the retired bindings and tables, must hold mut.
+	void Reclaim();
+
+	std::atomic<Table *> table_;
+	std::atomic<Node::State::SymbolTableInterface *> fallback_ = {nullptr};
+	std::size_t count = 0;
+
+	// serializes writers.
+	std::mutex mut;
+	std::vector<const Binding *> retired_bindings;
+	std::vector<Table *> retired_tables;
+
+	// readers are striped by thread to keep Get off a shared cache line.
+	mutable Readers readers_[kStripes] = {};
+	std::atomic<unsigned> phase_ = {0};
+};
+
 class NullNode : public Node {
 public:
+	NullNode();
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
 };
 
 class ParentNodeInterface : public Node {
@@ -87,12 +216,16 @@ public:
 class ParentNode : public ParentNodeInterface {
 public:
 	virtual void Put(Node *node);
+	// replaces the most recently put child.
+	void ReplaceLast(Node *node) { children_.back() = node; }
+	const std::vector<Node *>& children() const { return children_; }
 protected:
 	std::vector<Node *> children_;
 };
 
 class ConstNode : public ParentNode {
 public:
+	ConstNode();
 	virtual Node *Eval(State *state) const { return child; }
 	virtual std::string PPrint() const;
 	virtual void Put(Node *node);
@@ -102,23 +235,45 @@ private:
 
 class CallableNode : public Node {
 public:
+	CallableNode();
 	virtual Node *Eval(State *state) const;
-	virtual Node *Call(std::vector<Node *>& params) = 0;
+	virtual Node *Call(Node::State *state, std::vector<Node *>& params) = 0;
 };
 
 class RootNode : public ParentNode {
+public:
+	RootNode();
 	virtual Node *Eval(State *state) const;
 	virtual void Put(Node *node);
 	virtual std::string PPrint() const;
 };
 
+class MacroNode;
+
 class ListNode : public ParentNode {
 public:
-	ListNode() {}
+	ListNode();
+	virtual ~ListNode();
 	virtual Node *Eval(State *state) const;
 	virtual void Put(Node *node);
 	virtual std::string PPrint() const;
-	std::vector<Node *> children() const { return children_; }
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+private:
+	// a macro call site is expanded once, the expansion
+	// is kept and evaluated in its place from then on.
+	// an expansion replaced after the macro is redefined may
+	// still be read by another thread, it is freed with the site.
+	struct Expansion {
+		const MacroNode *macro;
+		Node *tree;
+		const Expansion *replaced;
+	};
+
+	// returns the expansion of this call to macro.
+	Node *Expand(const MacroNode *macro) const;
+
+	mutable std::atomic<const Expansion *> expansion_ = {nullptr};
 };
 
 class ErrorNode : public Node {
@@ -126,6 +281,8 @@ public:
 	ErrorNode(std::string msg);
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
 private:
 	std::string msg_;
 };
@@ -135,7 +292,9 @@ public:
 	IdentNode(std::string ident);
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
-	std::string str() const { return str_; }
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	const std::string& str() const { return str_; }
 private:
 	std::string str_;
 };
@@ -145,18 +304,23 @@ public:
 	NumNode(int n);
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	int num() const { return num_; }
 private:
-	int num;
+	int num_;
 };
 
 class StringNode : public Node {
 public:
-	StringNode(std::string str);
+	StringNode(SharedString str);
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
-	std::string str() const { return str_; }
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	const SharedString& str() const { return str_; }
 private:
-	std::string str_;
+	SharedString str_;
 };
 
 class BooleanNode : public Node {
@@ -164,11 +328,156 @@ public:
 	BooleanNode(bool val);
 	virtual Node *Eval(State *state) const;
 	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
 	bool value() const { return value_; }
 private:
 	bool value_;
 };
 
+// persistent hash map, keyed by structure.
+class MapNode : public Node {
+public:
+	MapNode(Hamt map);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	const Hamt& map() const { return map_; }
+private:
+	Hamt map_;
+};
+
+// persistent hash set, stored as a map of its members to themselves.
+class SetNode : public Node {
+public:
+	SetNode(Hamt set);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	const Hamt& set() const { return set_; }
+private:
+	Hamt set_;
+};
+
+// runtime list value built by the list builtins. it prints, hashes
+// and compares like a ListNode of the same items, but evaluates to
+// itself rather than being called.
+class VListNode : public Node {
+public:
+	VListNode(VList list);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+	virtual std::size_t Hash() const;
+	virtual bool Equal(const Node *other) const;
+	const VList& list() const { return list_; }
+private:
+	VList list_;
+};
+
+// delayed expression whose value is computed when first forced
+// and remembered. it evaluates to itself.
+class PromiseNode : public Node {
+public:
+	PromiseNode(Node *exp, State *state);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+
+	// returns the value of the expression. promises that yield
+	// promises are forced in a loop, not recursively, and all of
+	// them remember the final value. errors are not remembered.
+	Node *Force();
+private:
+	Node *exp_;
+	State *state_;
+	std::atomic<Node *> value_ = {nullptr};
+};
+
+// lazy sequence of a source transformed by a chain of stages.
+// the stages are fused, each element passes through all of them
+// before the next is produced, so chaining stages builds no
+// intermediate lists. it evaluates to itself.
+class SeqNode : public Node {
+public:
+	struct Stage {
+		enum Kind {
+			kMap,
+			kFilter,
+			kTake,
+			kDrop,
+		};
+		Kind kind;
+		// the callable of a map or filter.
+		CallableNode *func;
+		// the count of a take or drop.
+		long n;
+	};
+
+	// the integers from start, by step, up to but excluding end.
+	// ranges without an end are infinite.
+	static SeqNode *Range(long start, long end, long step, bool bounded);
+
+	// the items of list.
+	static SeqNode *Of(VList list);
+
+	// the lines of text without their newlines, as strings
+	// sharing text's characters.
+	static SeqNode *Lines(SharedString text);
+
+	// returns a sequence of this one's elements passed through stage.
+	// drops merge with a trailing drop or advance an unstaged source.
+	SeqNode *With(Stage stage) const;
+
+	// calls fn with each element until fn returns false or the
+	// sequence ends, calling the stages in state.
+	// returns the first ErrorNode produced, or nullptr.
+	Node *ForEach(State *state, const std::function<bool(Node *)>& fn) const;
+
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+private:
+	SeqNode();
+
+	enum Source {
+		kRange,
+		kList,
+		kLines,
+	};
+	Source source_;
+	long start_, end_, step_;
+	bool bounded_;
+	VList list_;
+	SharedString text_;
+
+	std::vector<Stage> stages_;
+};
+
+// macro defined by defmacro. a call to a macro is replaced by the
+// code its body returns, with the parameters bound to the call's
+// unevaluated atoms. the body is evaluated in the scope the macro
+// was defined in, so the names it uses cannot be captured at the
+// call site. it evaluates to itself.
+class MacroNode : public Node {
+public:
+	MacroNode(std::string name, std::vector<std::string> params, Node *body, State::SymbolTableInterface *scope);
+	virtual Node *Eval(State *state) const;
+	virtual std::string PPrint() const;
+
+	// returns the code for a call with atoms args,
+	// or an ErrorNode if the body fails.
+	Node *Expand(const std::vector<Node *>& args) const;
+private:
+	std::string name_;
+	std::vector<std::string> params_;
+	Node *body_;
+	State::SymbolTableInterface *scope_;
+};
+
+// returns a node that evaluates to value,
+// wrapping values that do not evaluate to themselves.
+Node *Quoted(Node *value);
+
 } // namespace crisp
 
 #endif // CRISP_TREE_H_
@@ -0,0 +1,207 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "utf8.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace crisp {
+namespace utf8 {
+
+namespace {
+
+struct Range {
+	char32_t first, last;
+};
+
+bool operator<(char32_t c, const Range& r) {
+	return c < r.first;
+}
+
+// letters of the major scripts, sorted.
+const Range kStart[] = {
+	{0x00AA, 0x00AA}, {0x00B5, 0x00B5}, {0x00BA, 0x00BA},
+	{0x00C0, 0x00D6}, {0x00D8, 0x00F6}, {0x00F8, 0x02C1},
+	{0x02C6, 0x02D1}, {0x02E0, 0x02E4}, {0x0370, 0x0374},
+	{0x0376, 0x0377}, {0x037B, 0x037D}, {0x037F, 0x037F},
+	{0x0386, 0x0386}, {0x0388, 0x03F5}, {0x03F7, 0x0481},
+	{0x048A, 0x052F}, {0x0531, 0x0556}, {0x0560, 0x0588},
+	{0x05D0, 0x05EA}, {0x0620, 0x064A}, {0x0671, 0x06D3},
+	{0x0904, 0x0939}, {0x0E01, 0x0E30}, {0x10A0, 0x10FF},
+	{0x1100, 0x11FF}, {0x1E00, 0x1FBC}, {0x2C00, 0x2CE4},
+	{0x3041, 0x3096}, {0x30A1, 0x30FA}, {0x3400, 0x4DBF},
+	{0x4E00, 0x9FFF}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF},
+	{0xFF21, 0xFF3A}, {0xFF41, 0xFF5A}, {0x20000, 0x2FFFF},
+};
+
+// marks, digits and joiners that may follow the first character, sorted.
+const Range kContinue[] = {
+	{0x0300, 0x036F}, {0x0483, 0x0487}, {0x0591, 0x05BD},
+	{0x0610, 0x061A}, {0x064B, 0x0669}, {0x06F0, 0x06F9},
+	{0x093A, 0x094F}, {0x0966, 0x096F}, {0x0E31, 0x0E3A},
+	{0x0E47, 0x0E4E}, {0x0E50, 0x0E59}, {0x1AB0, 0x1AFF},
+	{0x1DC0, 0x1DFF}, {0x200C, 0x200D}, {0x203F, 0x2040},
+	{0x20D0, 0x20FF}, {0x3099, 0x309A}, {0xFE00, 0xFE0F},
+	{0xFE20, 0xFE2F}, {0xFF10, 0xFF19},
+};
+
+template <std::size_t n>
+bool In(const Range (&table)[n], char32_t c) {
+	auto i = std::upper_bound(table, table + n, c);
+	return i != table && c <= (i - 1)->last;
+}
+
+} // namespace
+
+std::size_t AsciiPrefix(const char *p, std::size_t n) {
+	std::size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+		int mask = _mm_movemask_epi8(v);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+#else
+	for (; i + 8 <= n; i += 8) {
+		uint64_t v;
+		memcpy(&v, p + i, sizeof(v));
+		if ((v & 0x8080808080808080ull) != 0) {
+			break;
+		}
+	}
+#endif
+	while (i < n && static_cast<unsigned char>(p[i]) < 0x80) {
+		i++;
+	}
+	return i;
+}
+
+int SequenceLength(char lead) {
+	unsigned char c = lead;
+	if (c < 0x80) {
+		return 1;
+	} else if (c >= 0xC2 && c <= 0xDF) {
+		return 2;
+	} else if (c >= 0xE0 && c <= 0xEF) {
+		return 3;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		return 4;
+	}
+	return 0;
+}
+
+std::size_t ValidPrefix(const char *p, std::size_t n, bool *partial) {
+	*partial = false;
+	std::size_t i = 0;
+	for (;;) {
+		i += AsciiPrefix(p + i, n - i);
+		if (i == n) {
+			return n;
+		}
+		int len = SequenceLength(p[i]);
+		if (len == 0) {
+			return i;
+		}
+		// the second byte is narrowed to rule out overlong
+		// forms, surrogates and code points past U+10FFFF.
+		unsigned char c = p[i], lo = 0x80, hi = 0xBF;
+		if (c == 0xE0) {
+			lo = 0xA0;
+		} else if (c == 0xED) {
+			hi = 0x9F;
+		} else if (c == 0xF0) {
+			lo = 0x90;
+		} else if (c == 0xF4) {
+			hi = 0x8F;
+		}
+		for (int j = 1; j < len; j++) {
+			if (i + j == n) {
+				*partial = true;
+				return i;
+			}
+			unsigned char b = p[i + j];
+			if (b < lo || b > hi) {
+				return i;
+			}
+			lo = 0x80;
+			hi = 0xBF;
+		}
+		i += len;
+	}
+}
+
+int Decode(const char *p, std::size_t n, char32_t *c) {
+	if (n == 0) {
+		return 0;
+	}
+	bool partial;
+	int len = SequenceLength(p[0]);
+	if (len == 0 || static_cast<std::size_t>(len) > n || ValidPrefix(p, len, &partial) != static_cast<std::size_t>(len)) {
+		return 0;
+	}
+	static const unsigned char kLeadMask[] = {0, 0x7F, 0x1F, 0x0F, 0x07};
+	char32_t v = static_cast<unsigned char>(p[0]) & kLeadMask[len];
+	for (int i = 1; i < len; i++) {
+		v = (v << 6) | (static_cast<unsigned char>(p[i]) & 0x3F);
+	}
+	*c = v;
+	return len;
+}
+
+namespace {
+
+bool IsContinuation(char c) {
+	return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+} // namespace
+
+std::size_t Count(const char *p, std::size_t n) {
+	std::size_t count = 0, i = 0;
+	for (;;) {
+		std::size_t ascii = AsciiPrefix(p + i, n - i);
+		count += ascii;
+		i += ascii;
+		if (i == n) {
+			return count;
+		}
+		count++;
+		for (i++; i < n && IsContinuation(p[i]); i++) {
+		}
+	}
+}
+
+std::size_t Offset(const char *p, std::size_t n, std::size_t index) {
+	std::size_t i = 0;
+	for (;;) {
+		std::size_t ascii = AsciiPrefix(p + i, std::min(n - i, index));
+		index -= ascii;
+		i += ascii;
+		if (i == n || index == 0) {
+			return i;
+		}
+		index--;
+		for (i++; i < n && IsContinuation(p[i]); i++) {
+		}
+	}
+}
+
+bool IsIdentStart(char32_t c) {
+	return In(kStart, c);
+}
+
+bool IsIdentContinue(char32_t c) {
+	return In(kStart, c) || In(kContinue, c);
+}
+
+} // namespace utf8
+} // namespace crisp
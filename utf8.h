@@ -0,0 +1,47 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_UTF8_H_
+#define CRISP_UTF8_H_
+
+#include <cstddef>
+
+namespace crisp {
+namespace utf8 {
+
+// returns the number of leading bytes of p that are ASCII.
+// runs of ASCII are skipped 16 bytes at a time.
+std::size_t AsciiPrefix(const char *p, std::size_t n);
+
+// returns the length of the longest prefix of p made of whole well
+// formed UTF-8 sequences. if the rest is only the start of a sequence
+// cut off by the end of p, *partial is set, so the caller can check
+// it again once it has the following bytes.
+std::size_t ValidPrefix(const char *p, std::size_t n, bool *partial);
+
+// returns the length of the sequence lead starts,
+// or 0 if lead cannot start one.
+int SequenceLength(char lead);
+
+// decodes the sequence at the start of p into *c and returns its
+// length, or returns 0 if p does not start with a whole sequence.
+int Decode(const char *p, std::size_t n, char32_t *c);
+
+// returns the number of characters in p. every byte that does not
+// continue a sequence starts a character, so stray bytes count as one.
+std::size_t Count(const char *p, std::size_t n);
+
+// returns the offset of character index of p, or n if p is shorter.
+std::size_t Offset(const char *p, std::size_t n, std::size_t index);
+
+// identifier classes, after XID_Start and XID_Continue of UAX #31.
+// the letters, marks and digits of the major scripts are covered,
+// ASCII is left to the lexer's own tables.
+bool IsIdentStart(char32_t c);
+bool IsIdentContinue(char32_t c);
+
+} // namespace utf8
+} // namespace crisp
+
+#endif // CRISP_UTF8_H_
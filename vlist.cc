@@ -0,0 +1,92 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "vlist.h"
+
+namespace crisp {
+
+namespace {
+
+// the smallest chunk a cons allocates.
+const std::size_t kMinChunk = 4;
+
+} // namespace
+
+VList VList::FromVector(const std::vector<Node *>& items) {
+	if (items.empty()) {
+		return VList();
+	}
+	auto c = new vlist::Chunk(items.size(), nullptr, 0);
+	c->items = items;
+	c->front.store(0, std::memory_order_relaxed);
+	return VList(c, 0, items.size());
+}
+
+Node *VList::First() const {
+	return chunk_->items[offset_];
+}
+
+VList VList::Rest() const {
+	if (size_ == 1) {
+		return VList();
+	}
+	if (offset_ + 1 < chunk_->items.size()) {
+		return VList(chunk_, offset_ + 1, size_ - 1);
+	}
+	return VList(chunk_->next, chunk_->next_offset, size_ - 1);
+}
+
+VList VList::Cons(Node *item) const {
+	if (chunk_ != nullptr && offset_ > 0) {
+		// the slot in front is ours if no other list has claimed it.
+		std::size_t front = offset_;
+		if (chunk_->front.compare_exchange_strong(front, offset_ - 1)) {
+			chunk_->items[offset_ - 1] = item;
+			return VList(chunk_, offset_ - 1, size_ + 1);
+		}
+	}
+	// never sized by the list, so consing onto a long list is O(1).
+	// a list filling its chunk gets one twice the size once, later lists
+	// sharing the same head branch off into small chunks.
+	std::size_t capacity = kMinChunk;
+	if (chunk_ != nullptr && offset_ == 0 && chunk_->grow > capacity) {
+		bool extended = false;
+		if (chunk_->extended.compare_exchange_strong(extended, true)) {
+			capacity = chunk_->grow;
+		}
+	}
+	auto c = new vlist::Chunk(capacity, size_ > 0 ? chunk_ : nullptr, offset_);
+	c->grow = 2 * capacity;
+	c->items[capacity - 1] = item;
+	c->front.store(capacity - 1, std::memory_order_relaxed);
+	return VList(c, capacity - 1, size_ + 1);
+}
+
+VList VList::Append(const VList& rest) const {
+	if (empty()) {
+		return rest;
+	}
+	if (rest.empty()) {
+		return *this;
+	}
+	// this list's items are copied into one chunk linking to rest.
+	auto c = new vlist::Chunk(size_, rest.chunk_, rest.offset_);
+	std::size_t i = 0;
+	ForEach([&](Node *n) {
+		c->items[i++] = n;
+	});
+	c->front.store(0, std::memory_order_relaxed);
+	return VList(c, 0, size_ + rest.size_);
+}
+
+std::vector<Node *> VList::ToVector() const {
+	std::vector<Node *> items;
+	items.reserve(size_);
+	ForEach([&](Node *n) {
+		items.push_back(n);
+	});
+	return items;
+}
+
+} // namespace crisp
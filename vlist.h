@@ -0,0 +1,98 @@
+// Copyright 2015 The Crisp Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRISP_VLIST_H_
+#define CRISP_VLIST_H_
+
+#include "heap.h"
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace crisp {
+
+class Node;
+
+namespace vlist {
+struct Chunk;
+} // namespace vlist
+
+// VList is an immutable list stored in chunks of contiguous items,
+// each chunk linking to the rest of the list. A list is a position in
+// a chunk, so Rest is O(1) without copying and walking a list reads
+// arrays rather than chasing a pointer per item.
+// chunks are filled from their end, Cons into the free slot in front
+// of a list's first item when no other list has taken it, otherwise
+// into a new chunk. new chunks start small and double along the chain
+// a list grows into by cons, the first list to fill a chunk gets the
+// larger one, others branching off it start small again.
+class VList {
+public:
+	VList() {}
+	// returns a list of items, stored in one chunk.
+	static VList FromVector(const std::vector<Node *>& items);
+
+	bool empty() const { return size_ == 0; }
+	std::size_t size() const { return size_; }
+
+	// returns the first item, the list must not be empty.
+	Node *First() const;
+	// returns the list after the first item, the list must not be empty.
+	VList Rest() const;
+	// returns the list of item followed by this list.
+	VList Cons(Node *item) const;
+	// returns the items of this list followed by the list rest.
+	VList Append(const VList& rest) const;
+
+	// calls fn for each item in order.
+	template <typename f>
+	void ForEach(f fn) const;
+	std::vector<Node *> ToVector() const;
+private:
+	VList(vlist::Chunk *chunk, std::size_t offset, std::size_t size)
+		: chunk_(chunk), offset_(offset), size_(size) {}
+
+	vlist::Chunk *chunk_ = nullptr;
+	std::size_t offset_ = 0;
+	std::size_t size_ = 0;
+};
+
+namespace vlist {
+
+// chunks are allocated from the current heap, with the lists using them.
+struct Chunk : public HeapObject {
+	Chunk(std::size_t capacity, Chunk *n, std::size_t n_offset)
+		: front(capacity), items(capacity), next(n), next_offset(n_offset) {}
+
+	// index of the first used slot, slots before it are free.
+	std::atomic<std::size_t> front;
+	std::vector<Node *> items;
+	// the list after the chunk's last item.
+	Chunk *next;
+	std::size_t next_offset;
+	// capacity of the chunk a full chunk grows into, zero for the smallest.
+	std::size_t grow = 0;
+	// set by the first cons in front of the chunk's first slot.
+	std::atomic<bool> extended = {false};
+};
+
+} // namespace vlist
+
+template <typename f>
+void VList::ForEach(f fn) const {
+	vlist::Chunk *c = chunk_;
+	std::size_t off = offset_;
+	for (std::size_t n = size_; n > 0; ) {
+		for (; off < c->items.size() && n > 0; off++, n--) {
+			fn(c->items[off]);
+		}
+		off = c->next_offset;
+		c = c->next;
+	}
+}
+
+} // namespace crisp
+
+#endif // CRISP_VLIST_H_